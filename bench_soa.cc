@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "cg.h"
+#include "cgsoa.h"
+
+/* times the scalar v3 code paths against the cgsoa.h kernels they were
+ * replaced with; e.g.
+ *   make bench_soa && ./bench_soa 1000000
+ */
+
+static double now()
+{
+	typedef std::chrono::high_resolution_clock clk;
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clk::now().time_since_epoch()).count() / 1e9;
+}
+
+/* best of a few runs, in ns per element */
+template <typename F>
+static double bench(int n, F fn)
+{
+	double best = 1e30;
+	for (int run = 0; run < 5; run++) {
+		double t0 = now();
+		fn();
+		double t = now() - t0;
+		if (t < best) best = t;
+	}
+	return best * 1e9 / n;
+}
+
+/* keeps results alive so the loops aren't optimized away */
+static volatile double sink;
+
+static void report(const char* what, double scalar, double soa)
+{
+	printf("%-16s %8.3f ns  %8.3f ns  %5.2fx\n", what, scalar, soa, scalar/soa);
+}
+
+int main(int argc, char** argv)
+{
+	const int n = argc > 1 ? atoi(argv[1]) : 1000000;
+	if (n <= 0) {
+		fprintf(stderr, "usage: %s [points]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+	auto rnd = []() { return (double)rand() / RAND_MAX * 200.0 - 100.0; };
+	std::vector<v3> aos(n);
+	for (int i = 0; i < n; i++) aos[i] = v3(rnd(), rnd(), rnd());
+	soa3 soa;
+	soa_load(aos, soa);
+
+	/* some rotation plus translation */
+	const double c = cos(0.3), s = sin(0.3);
+	const double m[12] = {
+		c, -s, 0, 10,
+		s,  c, 0, -5,
+		0,  0, 1,  2,
+	};
+	const v3 plane_p(1, 2, 3), plane_n = v3(1, 1, 1).unit();
+
+	printf("%d points              scalar        soa\n", n);
+
+	std::vector<v3> aos_out(n);
+	soa3 soa_out;
+	report("transform", bench(n, [&]() {
+		for (int i = 0; i < n; i++) {
+			const v3& p = aos[i];
+			aos_out[i] = v3(
+				m[0]*p.x + m[1]*p.y + m[2]*p.z + m[3],
+				m[4]*p.x + m[5]*p.y + m[6]*p.z + m[7],
+				m[8]*p.x + m[9]*p.y + m[10]*p.z + m[11]);
+		}
+		sink = aos_out[n-1].x;
+	}), bench(n, [&]() {
+		soa_transform(m, soa, soa_out);
+		sink = soa_out.x[n-1];
+	}));
+
+	/* triangles (i, i+1, i+2) */
+	const int n_tris = n - 2;
+	soa3 a, b, cc;
+	a.resize(n_tris); b.resize(n_tris); cc.resize(n_tris);
+	for (int i = 0; i < n_tris; i++) {
+		a.set(i, aos[i]);
+		b.set(i, aos[i+1]);
+		cc.set(i, aos[i+2]);
+	}
+	report("face normals", bench(n_tris, [&]() {
+		for (int i = 0; i < n_tris; i++) {
+			v3 normal = (aos[i+1]-aos[i]).cross(aos[i+2]-aos[i]);
+			aos_out[i] = normal.length() == 0 ? v3() : normal.unit();
+		}
+		sink = aos_out[n_tris-1].x;
+	}), bench(n_tris, [&]() {
+		soa_face_normals(a, b, cc, soa_out);
+		sink = soa_out.x[n_tris-1];
+	}));
+
+	std::vector<double> dist(n);
+	report("plane distances", bench(n, [&]() {
+		for (int i = 0; i < n; i++) dist[i] = (aos[i]-plane_p).dot(plane_n);
+		sink = dist[n-1];
+	}), bench(n, [&]() {
+		soa_plane_distances(soa, plane_p, plane_n, dist.data());
+		sink = dist[n-1];
+	}));
+
+	report("y-up swizzle", bench(n, [&]() {
+		for (int i = 0; i < n; i++) aos_out[i] = v3(aos[i].x, aos[i].z, -aos[i].y);
+		sink = aos_out[n-1].y;
+	}), bench(n, [&]() {
+		soa_swizzle_yup(soa, soa_out);
+		sink = soa_out.y[n-1];
+	}));
+
+	v3 mn, mx;
+	report("bounds", bench(n, [&]() {
+		mn = v3(INFINITY, INFINITY, INFINITY);
+		mx = v3(-INFINITY, -INFINITY, -INFINITY);
+		for (int i = 0; i < n; i++) {
+			for (int k = 0; k < 3; k++) {
+				mn.s[k] = fmin(mn.s[k], aos[i].s[k]);
+				mx.s[k] = fmax(mx.s[k], aos[i].s[k]);
+			}
+		}
+		sink = mn.x + mx.x;
+	}), bench(n, [&]() {
+		soa_bounds(soa, mn, mx);
+		sink = mn.x + mx.x;
+	}));
+
+	return EXIT_SUCCESS;
+}
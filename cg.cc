@@ -1,38 +1,86 @@
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include <vector>
 #include <map>
+#include <set>
+#include <queue>
+#include <algorithm>
 #include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 // OpenCASCADE
 #include <BRepAlgoAPI_Common.hxx>
 #include <BRepAlgoAPI_Cut.hxx>
 #include <BRepAlgoAPI_Fuse.hxx>
+#include <BOPAlgo_GlueEnum.hxx>
+#include <Message_ProgressIndicator.hxx>
+#include <TopTools_ListOfShape.hxx>
+#include <TopTools_ListIteratorOfListOfShape.hxx>
 #include <BRepBuilderAPI_MakeEdge.hxx>
 #include <BRepBuilderAPI_MakeFace.hxx>
 #include <BRepBuilderAPI_MakeWire.hxx>
 #include <BRepBuilderAPI_Transform.hxx>
+#include <BRepBuilderAPI_Copy.hxx>
 #include <BRepFilletAPI_MakeFillet.hxx>
+#include <BRepGProp_Face.hxx>
 #include <BRepMesh_IncrementalMesh.hxx>
+#include <BRepOffsetAPI_MakeOffsetShape.hxx>
+#include <BRepOffsetAPI_MakeThickSolid.hxx>
 #include <BRepPrimAPI_MakeBox.hxx>
 #include <BRepPrimAPI_MakeWedge.hxx>
 #include <BRepPrimAPI_MakeCylinder.hxx>
 #include <BRepPrimAPI_MakeCone.hxx>
 #include <BRepPrimAPI_MakePrism.hxx>
+#include <BRepPrimAPI_MakeRevol.hxx>
 #include <BRepPrimAPI_MakeSphere.hxx>
 #include <BRep_Builder.hxx>
+#include <BRep_Tool.hxx>
+#include <BRepTools.hxx>
+#include <BRepTools_History.hxx>
+#include <Geom_Plane.hxx>
+#include <Geom_Surface.hxx>
+#include <BRepBndLib.hxx>
+#include <ShapeFix_Face.hxx>
+#include <ShapeUpgrade_UnifySameDomain.hxx>
+#include <Bnd_Box.hxx>
+#include <BinTools.hxx>
+#include <BRepClass3d_SolidClassifier.hxx>
 #include <GC_MakeArcOfCircle.hxx>
 #include <GC_MakeSegment.hxx>
 #include <Poly.hxx>
+#include <Precision.hxx>
+#include <TopExp.hxx>
 #include <TopExp_Explorer.hxx>
+#include <TopTools_IndexedDataMapOfShapeListOfShape.hxx>
+#include <TopTools_MapOfShape.hxx>
 #include <TopoDS.hxx>
 #include <TopoDS_Compound.hxx>
 #include <TopoDS_Face.hxx>
 #include <TopoDS_Shape.hxx>
 #include <gp_Ax1.hxx>
+#include <gp_Circ.hxx>
 
 #include "cg.h"
+#include "cgsoa.h"
 
 struct stopwatch {
 	typedef std::chrono::high_resolution_clock clk;
@@ -60,6 +108,35 @@ struct scope_timer {
 	}
 };
 
+static char* str_concat(const char* s1, const char* s2)
+{
+	char* result = (char*) malloc(strlen(s1)+strlen(s2)+1);
+	assert(result != NULL);
+	strcpy(result, s1);
+	strcat(result, s2);
+	return result;
+}
+
+static std::string str_printf(const char* fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	return buf;
+}
+
+static FILE* fopen_for_write(const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	return f;
+}
+
 struct node;
 
 node* tree_root = NULL;
@@ -86,10 +163,48 @@ struct cull_volume {
 	}
 };
 
-std::vector<cull_volume> cull_volumes;
+/* thread_local like the other per-object evaluation state, so a
+ * --pipeline writer thread can mesh against a snapshot */
+thread_local std::vector<cull_volume> cull_volumes;
+
+/* true if the axis-aligned box [mn;mx] lies inside one cull volume;
+ * volumes are convex, so checking the corners is enough */
+static bool is_box_culled(const v3& mn, const v3& mx)
+{
+	for (int j = 0; j < cull_volumes.size(); j++) {
+		const cull_volume& vol = cull_volumes[j];
+		bool inside = true;
+		for (int i = 0; i < 8 && inside; i++) {
+			inside = vol.is_inside(v3((i&1) ? mx.x : mn.x, (i&2) ? mx.y : mn.y, (i&4) ? mx.z : mn.z));
+		}
+		if (inside) return true;
+	}
+	return false;
+}
+
+static bool is_culled(const v3& p0, const v3& p1, const v3& p2)
+{
+	for (int j = 0; j < cull_volumes.size(); j++) {
+		const cull_volume& vol = cull_volumes[j];
+		if (vol.is_inside(p0) && vol.is_inside(p1) && vol.is_inside(p2)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct v3_less {
+	bool operator()(const v3& a, const v3& b) const  {
+		v3 d = a-b;
+		if (d.x != 0) return d.x < 0;
+		if (d.y != 0) return d.y < 0;
+		return d.z < 0;
+	}
+};
 
 struct triangle {
 	int v0,v1,v2,n;
+	int face_id; // source face; edges between different faces are features
 };
 
 struct mesh {
@@ -98,257 +213,3475 @@ struct mesh {
 	std::vector<triangle> triangles;
 };
 
-char* run_write_obj = NULL;
-bool run_dump = false;
-
-enum node_type {
-	MKOBJ = 1,
-	GROUP,
-	TRANSLATE,
-	ROTATE,
-	CUT,
-	COMMON,
-	FUSE,
-	FILLET,
-	BOX,
-	WEDGE,
-	SPHERE,
-	CYLINDER,
-	CONE,
+/* the arrays the exporters read, owned by a mesh or mapped from a
+ * --mesh-cache file */
+struct mesh_view {
+	const v3* vertices;
+	const v3* normals;
+	const triangle* triangles;
+	int n_vertices, n_normals, n_triangles;
 
-	FACE,
-	MOVE_TO,
-	LINE_TO,
-	CIRCLE_ARC_TO,
-	PRISM,
-};
+	mesh_view() : vertices(NULL), normals(NULL), triangles(NULL), n_vertices(0), n_normals(0), n_triangles(0) {}
 
-struct v3_less {
-	bool operator()(const v3& a, const v3& b) const  {
-		v3 d = a-b;
-		if (d.x != 0) return d.x < 0;
-		if (d.y != 0) return d.y < 0;
-		return d.z < 0;
-	}
+	mesh_view(const struct mesh* m)
+		: vertices(m->vertices.data()), normals(m->normals.data()), triangles(m->triangles.data())
+		, n_vertices(m->vertices.size()), n_normals(m->normals.size()), n_triangles(m->triangles.size())
+	{}
 };
 
-static v3 gp_Pnt_to_v3(const gp_Pnt& p)
-{
-	return v3(p.X(), p.Y(), p.Z());
-}
-
-static gp_Pnt v3_to_gp_Pnt(const v3& v)
-{
-	return gp_Pnt(v.x, v.y, v.z);
-}
-
-static void dump_gp_Trsf(const gp_Trsf& tx)
+static void write_obj(const mesh_view& mesh, const char* path_prefix, const char* object_name)
 {
-	for (int row = 1; row <= 3; row++) {
-		for (int col = 1; col <= 4; col++) {
-			printf("%.3f ", tx.Value(row, col));
-		}
-		printf("\n");
+	char* filename_obj = str_concat(path_prefix, ".obj");
+	char* filename_mtl = str_concat(path_prefix, ".mtl");
+
+	FILE* file_obj = fopen_for_write(filename_obj);
+	FILE* file_mtl = fopen_for_write(filename_mtl);
+
+	/* seems Y is up in Wavefront OBJ, so Blender actually
+	 * swizzles the input coordinates; guess I have to
+	 * unswizzle them then! */
+	soa3 zup, yup;
+
+	/* write .obj */
+	fprintf(file_obj, "mtllib %s\n", filename_mtl);
+	fprintf(file_obj, "o %s\n", object_name);
+	soa_load(mesh.vertices, mesh.n_vertices, zup);
+	soa_swizzle_yup(zup, yup);
+	for (size_t i = 0; i < yup.size(); i++) {
+		fprintf(file_obj, "v %.6f %.6f %.6f\n", yup.x[i], yup.y[i], yup.z[i]);
+	}
+	soa_load(mesh.normals, mesh.n_normals, zup);
+	soa_swizzle_yup(zup, yup);
+	for (size_t i = 0; i < yup.size(); i++) {
+		fprintf(file_obj, "vn %.6f %.6f %.6f\n", yup.x[i], yup.y[i], yup.z[i]);
+	}
+	fprintf(file_obj, "usemtl Mat\n");
+	fprintf(file_obj, "s off\n");
+	for (int i = 0; i < mesh.n_triangles; i++) {
+		const triangle& t = mesh.triangles[i];
+		fprintf(file_obj, "f %d//%d %d//%d %d//%d\n", t.v0+1, t.n+1, t.v1+1, t.n+1, t.v2+1, t.n+1);
 	}
-}
 
-struct node {
-	enum node_type type;
-	std::vector<node*> children;
+	/* write .mtl */
+	fprintf(file_mtl, "newmtl Mat\n");
+	fprintf(file_mtl, "Ns 0\n");
+	fprintf(file_mtl, "Ka 0.000000 0.000000 0.000000\n");
+	fprintf(file_mtl, "Kd 0.8 0.8 0.8\n");
+	fprintf(file_mtl, "Ks 0.8 0.8 0.8\n");
+	fprintf(file_mtl, "d 1\n");
+	fprintf(file_mtl, "illum 2\n");
 
-	union {
-		struct {
-			const char* name;
-			double linear_deflection;
-			bool is_relative;
-			double angular_deflection;
-		} mkobj;
+	fclose(file_mtl);
+	fclose(file_obj);
 
-		struct {
-			v3 v;
-		} translate;
+	free(filename_mtl);
+	free(filename_obj);
+}
 
-		struct {
-			double degrees;
-			v3 axis;
-		} rotate;
+/* meshlets for GPU-driven renderers: small clusters of triangles with
+ * their own vertex lists and the bounds to cull them by */
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_MAGIC "CGML"
+#define MESHLET_VERSION 1
+
+struct meshlet {
+	/* into the meshlet vertex and meshlet triangle arrays */
+	uint32_t vertex_offset, triangle_offset;
+	uint32_t vertex_count, triangle_count;
+	/* bounding sphere */
+	float center[3], radius;
+	/* normal cone: the meshlet faces away from a camera at c when
+	 * dot(center-c, cone_axis) >= cone_cutoff*|center-c| + radius;
+	 * cone_cutoff is 1 when its normals are too spread out for that */
+	float cone_axis[3], cone_cutoff;
+};
 
-		struct {
-			double radius;
-		} fillet;
+/* the file is this header, then (native byte order)
+ *   float    positions[n_vertices][3], Y-up like the OBJ/glTF ones
+ *   meshlet  meshlets[n_meshlets]
+ *   uint32_t meshlet_vertices[n_meshlet_vertices], indices into positions
+ *   uint8_t  meshlet_triangles[n_meshlet_triangles][3], indices into the
+ *            meshlet's slice of meshlet_vertices
+ * positions are the OBJ "v" lines in order */
+struct meshlet_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t n_vertices, n_meshlets, n_meshlet_vertices, n_meshlet_triangles;
+};
 
-		struct {
-			v3 size;
-		} box;
+static_assert(sizeof(meshlet) == 48, "meshlet is stored as it is");
 
-		struct {
-			v3 size;
-			double ltx;
-		} wedge;
+struct meshlet_set {
+	std::vector<meshlet> meshlets;
+	std::vector<uint32_t> vertices;
+	std::vector<uint8_t> triangles;
+};
 
-		struct {
-			double radius;
-		} sphere;
+/* spreads the low 10 bits of v out to every third bit */
+static uint32_t morton_spread(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
 
-		struct {
-			double radius, height;
-		} cylinder;
+/* greedily packs the triangles order[0..n) into meshlets, starting a
+ * new one whenever the next triangle would not fit */
+static void build_meshlets(const mesh_view& m, const soa3& pos, const soa3& normals, const uint32_t* order, size_t n, meshlet_set& out)
+{
+	meshlet ml;
+	std::vector<int> tris; // mesh triangles of ml
+
+	auto finish = [&]() {
+		if (ml.triangle_count == 0) return;
+
+		/* sphere around the bounding box center; measured between the
+		 * float center and float positions that are stored */
+		v3 mn(INFINITY, INFINITY, INFINITY), mx(-INFINITY, -INFINITY, -INFINITY);
+		for (uint32_t i = 0; i < ml.vertex_count; i++) {
+			const v3 p = pos.get(out.vertices[ml.vertex_offset + i]);
+			for (int k = 0; k < 3; k++) {
+				mn.s[k] = fmin(mn.s[k], p.s[k]);
+				mx.s[k] = fmax(mx.s[k], p.s[k]);
+			}
+		}
+		for (int k = 0; k < 3; k++) ml.center[k] = (mn.s[k] + mx.s[k]) / 2;
+		const v3 c(ml.center[0], ml.center[1], ml.center[2]);
+		double r = 0;
+		for (uint32_t i = 0; i < ml.vertex_count; i++) {
+			const v3 p = pos.get(out.vertices[ml.vertex_offset + i]);
+			r = fmax(r, (v3((float)p.x, (float)p.y, (float)p.z) - c).length());
+		}
+		ml.radius = nextafterf((float)r, INFINITY);
+
+		v3 axis;
+		for (int i = 0; i < tris.size(); i++) axis = axis + normals.get(m.triangles[tris[i]].n);
+		double min_dot = 1;
+		if (axis.length() > 1e-6) {
+			axis = axis.unit();
+			for (int i = 0; i < tris.size(); i++) min_dot = fmin(min_dot, axis.dot(normals.get(m.triangles[tris[i]].n)));
+		} else {
+			min_dot = -1;
+		}
+		for (int k = 0; k < 3; k++) ml.cone_axis[k] = axis.s[k];
+		/* the cone of view directions that see only back faces is the
+		 * normal cone widened by 90 degrees; its cos is sin() of the
+		 * normal cone angle. Almost flat spreads are not worth culling */
+		ml.cone_cutoff = min_dot <= 0.1 ? 1 : (float)sqrt(1 - min_dot*min_dot);
 
-		struct {
-			double r0, r1, height;
-		} cone;
+		out.meshlets.push_back(ml);
+	};
+	auto start = [&]() {
+		memset(&ml, 0, sizeof ml);
+		ml.vertex_offset = out.vertices.size();
+		ml.triangle_offset = out.triangles.size() / 3;
+		tris.clear();
+	};
 
-		struct {
-			v3 v;
-		} prism;
+	start();
+	for (size_t i = 0; i < n; i++) {
+		const triangle& t = m.triangles[order[i]];
+		const int vs[3] = { t.v0, t.v1, t.v2 };
 
-		struct {
-			v3 p;
-		} move_to;
+		/* meshlets are small enough to search */
+		auto find = [&](int v) {
+			for (uint32_t j = 0; j < ml.vertex_count; j++) {
+				if (out.vertices[ml.vertex_offset + j] == v) return (int)j;
+			}
+			return -1;
+		};
+		int n_new = 0;
+		for (int k = 0; k < 3; k++) {
+			if (find(vs[k]) < 0 && (k == 0 || vs[k] != vs[0]) && (k < 2 || vs[k] != vs[1])) n_new++;
+		}
+		if (ml.triangle_count == MESHLET_MAX_TRIANGLES || ml.vertex_count + n_new > MESHLET_MAX_VERTICES) {
+			finish();
+			start();
+		}
 
-		struct {
-			v3 p;
-		} line_to;
+		for (int k = 0; k < 3; k++) {
+			int j = find(vs[k]);
+			if (j < 0) {
+				j = ml.vertex_count++;
+				out.vertices.push_back(vs[k]);
+			}
+			out.triangles.push_back(j);
+		}
+		ml.triangle_count++;
+		tris.push_back(order[i]);
+	}
+	finish();
+}
 
-		struct {
-			v3 via, p;
-		} circle_arc_to;
+/* writes <path_prefix>.meshlets. Triangles are sorted along a Morton
+ * curve through their centroids, so consecutive ones are close, then cut
+ * into meshlets in fixed-size runs that are packed on up to max_jobs
+ * threads; the runs do not depend on the thread count, nor does the file */
+static void write_meshlets(const mesh_view& mesh, const char* path_prefix, int max_jobs)
+{
+	scope_timer ST("write meshlets");
+
+	soa3 zup, pos, normals;
+	soa_load(mesh.vertices, mesh.n_vertices, zup);
+	soa_swizzle_yup(zup, pos);
+	soa_load(mesh.normals, mesh.n_normals, zup);
+	soa_swizzle_yup(zup, normals);
+
+	v3 mn, mx;
+	soa_bounds(pos, mn, mx);
+	double extent = 0;
+	for (int k = 0; k < 3; k++) extent = fmax(extent, mx.s[k] - mn.s[k]);
+	const double scale = extent > 0 ? 1023 / extent : 0;
+
+	std::vector<std::pair<uint32_t, uint32_t>> keyed(mesh.n_triangles);
+	for (int i = 0; i < mesh.n_triangles; i++) {
+		const triangle& t = mesh.triangles[i];
+		const v3 centroid = (pos.get(t.v0) + pos.get(t.v1) + pos.get(t.v2)) / 3;
+		uint32_t code = 0;
+		for (int k = 0; k < 3; k++) code |= morton_spread((uint32_t)((centroid.s[k] - mn.s[k]) * scale)) << k;
+		keyed[i] = std::make_pair(code, (uint32_t)i);
+	}
+	std::sort(keyed.begin(), keyed.end());
+	std::vector<uint32_t> order(mesh.n_triangles);
+	for (int i = 0; i < mesh.n_triangles; i++) order[i] = keyed[i].second;
+	std::vector<std::pair<uint32_t, uint32_t>>().swap(keyed);
+
+	const size_t run = 1 << 15;
+	const size_t n_runs = (order.size() + run - 1) / run;
+	std::vector<meshlet_set> sets(n_runs);
+	auto pack = [&](size_t first) {
+		for (size_t i = first; i < n_runs; i += max_jobs) {
+			build_meshlets(mesh, pos, normals, order.data() + i*run, std::min(run, order.size() - i*run), sets[i]);
+		}
 	};
+	if (max_jobs > (int)n_runs) max_jobs = n_runs;
+	if (max_jobs < 1) max_jobs = 1;
+	std::vector<std::thread> threads;
+	for (int t = 1; t < max_jobs; t++) threads.push_back(std::thread(pack, t));
+	pack(0);
+	for (int t = 0; t < threads.size(); t++) threads[t].join();
+
+	/* runs were packed on their own; rebase their offsets */
+	meshlet_set all;
+	for (size_t i = 0; i < n_runs; i++) {
+		for (int j = 0; j < sets[i].meshlets.size(); j++) {
+			meshlet ml = sets[i].meshlets[j];
+			ml.vertex_offset += all.vertices.size();
+			ml.triangle_offset += all.triangles.size() / 3;
+			all.meshlets.push_back(ml);
+		}
+		all.vertices.insert(all.vertices.end(), sets[i].vertices.begin(), sets[i].vertices.end());
+		all.triangles.insert(all.triangles.end(), sets[i].triangles.begin(), sets[i].triangles.end());
+		sets[i] = meshlet_set();
+	}
 
-	node(enum node_type type) : type(type) {}
+	std::vector<float> xyz(pos.size() * 3);
+	for (size_t i = 0; i < pos.size(); i++) {
+		xyz[i*3+0] = pos.x[i];
+		xyz[i*3+1] = pos.y[i];
+		xyz[i*3+2] = pos.z[i];
+	}
 
-	bool is_leaf() {
-		switch (type) {
-		case MKOBJ:
-		case GROUP:
-		case TRANSLATE:
-		case ROTATE:
-		case CUT:
-		case COMMON:
-		case FUSE:
-		case FILLET:
-		case PRISM:
-		case FACE:
-			return false;
-		case BOX:
-		case WEDGE:
-		case SPHERE:
-		case CYLINDER:
-		case CONE:
-		case MOVE_TO:
-		case LINE_TO:
-		case CIRCLE_ARC_TO:
-			return true;
-		}
-		assert(!"unhandled type");
+	meshlet_header h;
+	memcpy(h.magic, MESHLET_MAGIC, 4);
+	h.version = MESHLET_VERSION;
+	h.n_vertices = pos.size();
+	h.n_meshlets = all.meshlets.size();
+	h.n_meshlet_vertices = all.vertices.size();
+	h.n_meshlet_triangles = all.triangles.size() / 3;
+
+	char* filename = str_concat(path_prefix, ".meshlets");
+	FILE* f = fopen_for_write(filename);
+	bool ok = fwrite(&h, sizeof h, 1, f) == 1
+		&& fwrite(xyz.data(), sizeof(float), xyz.size(), f) == xyz.size()
+		&& fwrite(all.meshlets.data(), sizeof(meshlet), all.meshlets.size(), f) == all.meshlets.size()
+		&& fwrite(all.vertices.data(), sizeof(uint32_t), all.vertices.size(), f) == all.vertices.size()
+		&& fwrite(all.triangles.data(), 1, all.triangles.size(), f) == all.triangles.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "%s: write failed\n", filename);
+		exit(EXIT_FAILURE);
 	}
+	free(filename);
 
-	void dump_rec(int depth = 0)
-	{
-		auto tab = [](int depth){ for (int i = 0; i < depth; i++) printf("   "); };
-		tab(depth);
+	printf("meshlets: %d, %.1f triangles and %.1f vertices each\n",
+		(int)all.meshlets.size(),
+		all.meshlets.size() ? (double)h.n_meshlet_triangles / all.meshlets.size() : 0.0,
+		all.meshlets.size() ? (double)h.n_meshlet_vertices / all.meshlets.size() : 0.0);
+}
 
-		switch (type) {
-		case MKOBJ: printf("mkobj(\"%s\")", mkobj.name); break;
-		case GROUP: printf("group"); break;
-		case TRANSLATE: printf("translate(%f,%f,%f)", translate.v.x, translate.v.y, translate.v.z); break;
-		case ROTATE: printf("rotate(degrees=%f, axis={%f,%f,%f})", rotate.degrees, rotate.axis.x, rotate.axis.y, rotate.axis.z); break;
-		case CUT: printf("cut"); break;
-		case COMMON: printf("common"); break;
-		case FUSE: printf("fuse"); break;
-		case FILLET: printf("fillet(radius=%f)", fillet.radius); break;
-		case PRISM: printf("prism(v={%f,%f,%f})", prism.v.x, prism.v.y, prism.v.z); break;
-		case FACE: printf("face"); break;
-		case BOX: printf("box(%f,%f,%f)", box.size.x, box.size.y, box.size.z); break;
-		case WEDGE: printf("wedge(%f,%f,%f,%f)", wedge.size.x, wedge.size.y, wedge.size.z, wedge.ltx); break;
-		case SPHERE: printf("sphere(%f)", sphere.radius); break;
-		case CYLINDER: printf("cylinder(r=%f,h=%f)", cylinder.radius, cylinder.height); break;
-		case CONE: printf("cone(r0=%f,r1=%f,h=%f)", cone.r0, cone.r1, cone.height); break;
-		case MOVE_TO: printf("move_to(p={%f,%f,%f})", move_to.p.x, move_to.p.y, move_to.p.z); break;
-		case LINE_TO: printf("line_to(p={%f,%f,%f})", line_to.p.x, line_to.p.y, line_to.p.z); break;
-		case CIRCLE_ARC_TO: printf("circle_arc_to(via={%f,%f,%f} p={%f,%f,%f})", circle_arc_to.via.x, circle_arc_to.via.y, circle_arc_to.via.z, circle_arc_to.p.x, circle_arc_to.p.y, circle_arc_to.p.z); break;
+/* --write-sdf: signed distances to a mesh on a voxel grid */
+#define SDF_MAGIC "CGSD"
+#define SDF_VERSION 1
+#define SDF_PADDING 2
+
+/* the file is this header, then float distances[nz][ny][nx] (native byte
+ * order) at the voxel centers origin + (x,y,z)*voxel_size, in the Y-up
+ * frame of the OBJ/glTF exports; negative inside */
+struct sdf_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t nx, ny, nz;
+	float origin[3];
+	float voxel_size;
+};
 
-		}
+/* bounding volume hierarchy over triangles for closest point queries.
+ * Leaves hold up to BVH_LEAF_SIZE triangles, stored structure-of-arrays
+ * in leaf order, so the distance loop over a leaf vectorizes */
+#define BVH_LEAF_SIZE 8
 
-		if (is_leaf()) {
-			printf(";\n");
-		} else {
-			printf(" {\n");
-			for (auto it = children.begin(); it != children.end(); it++) {
-				(*it)->dump_rec(depth+1);
+struct tri_bvh {
+	struct bvh_node {
+		v3 mn, mx;
+		int right; // the left child follows its parent
+		int first, count; // triangles of a leaf; count is 0 for inner nodes
+	};
+	std::vector<bvh_node> nodes;
+
+	/* per triangle, in leaf order: a, b-a, c-b, a-c, the normal, and
+	 * reciprocal squared lengths of the edges and normal (0 if degenerate) */
+	soa3 a, ba, cb, ac, n;
+	std::vector<double> inv_ba, inv_cb, inv_ac, inv_nn;
+
+	void build(const soa3& pos, const triangle* tris, int n_tris)
+	{
+		std::vector<int> order(n_tris);
+		std::vector<v3> centroids(n_tris), tmn(n_tris), tmx(n_tris);
+		for (int i = 0; i < n_tris; i++) {
+			const v3 p0 = pos.get(tris[i].v0), p1 = pos.get(tris[i].v1), p2 = pos.get(tris[i].v2);
+			order[i] = i;
+			centroids[i] = (p0 + p1 + p2) / 3;
+			for (int k = 0; k < 3; k++) {
+				tmn[i].s[k] = fmin(p0.s[k], fmin(p1.s[k], p2.s[k]));
+				tmx[i].s[k] = fmax(p0.s[k], fmax(p1.s[k], p2.s[k]));
 			}
-			tab(depth); printf("}\n");
+		}
+		nodes.clear();
+		if (n_tris > 0) build_rec(order, centroids, tmn, tmx, 0, n_tris);
+
+		a.resize(n_tris); ba.resize(n_tris); cb.resize(n_tris); ac.resize(n_tris); n.resize(n_tris);
+		inv_ba.resize(n_tris); inv_cb.resize(n_tris); inv_ac.resize(n_tris); inv_nn.resize(n_tris);
+		auto inv = [](const v3& v) { const double d = v.dot(v); return d > 0 ? 1/d : 0; };
+		for (int i = 0; i < n_tris; i++) {
+			const triangle& t = tris[order[i]];
+			const v3 p0 = pos.get(t.v0), p1 = pos.get(t.v1), p2 = pos.get(t.v2);
+			const v3 e0 = p1-p0, e1 = p2-p1, e2 = p0-p2, nor = e0.cross(e2);
+			a.set(i, p0); ba.set(i, e0); cb.set(i, e1); ac.set(i, e2); n.set(i, nor);
+			inv_ba[i] = inv(e0);
+			inv_cb[i] = inv(e1);
+			inv_ac[i] = inv(e2);
+			inv_nn[i] = inv(nor);
 		}
 	}
 
-	TopoDS_Shape build_group_shape(int offset = 0)
+	void build_rec(std::vector<int>& order, const std::vector<v3>& centroids, const std::vector<v3>& tmn, const std::vector<v3>& tmx, int begin, int end)
 	{
-		TopoDS_Compound shp;
-		BRep_Builder b;
-		b.MakeCompound(shp);
-		for (int i = offset; i < children.size(); i++) {
-			b.Add(shp, children[i]->build_shape_rec());
+		const int ni = nodes.size();
+		nodes.push_back(bvh_node());
+		v3 mn(INFINITY, INFINITY, INFINITY), mx(-INFINITY, -INFINITY, -INFINITY);
+		v3 cmn = mn, cmx = mx;
+		for (int i = begin; i < end; i++) {
+			for (int k = 0; k < 3; k++) {
+				mn.s[k] = fmin(mn.s[k], tmn[order[i]].s[k]);
+				mx.s[k] = fmax(mx.s[k], tmx[order[i]].s[k]);
+				cmn.s[k] = fmin(cmn.s[k], centroids[order[i]].s[k]);
+				cmx.s[k] = fmax(cmx.s[k], centroids[order[i]].s[k]);
+			}
 		}
-		return shp;
+		nodes[ni].mn = mn;
+		nodes[ni].mx = mx;
+		nodes[ni].first = begin;
+		nodes[ni].count = end - begin;
+		nodes[ni].right = -1;
+
+		/* median split along the longest centroid extent */
+		int axis = 0;
+		for (int k = 1; k < 3; k++) if (cmx.s[k]-cmn.s[k] > cmx.s[axis]-cmn.s[axis]) axis = k;
+		if (end - begin <= BVH_LEAF_SIZE || cmx.s[axis] <= cmn.s[axis]) return;
+		const int mid = (begin + end) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](int i, int j) {
+			return centroids[i].s[axis] < centroids[j].s[axis];
+		});
+		nodes[ni].count = 0;
+		build_rec(order, centroids, tmn, tmx, begin, mid);
+		nodes[ni].right = nodes.size();
+		build_rec(order, centroids, tmn, tmx, mid, end);
 	}
 
-	TopoDS_Shape build_transform(gp_Trsf tx)
+	static double box_dist2(const bvh_node& nd, const v3& p)
 	{
-		return BRepBuilderAPI_Transform(build_group_shape(), tx, true).Shape();
+		double d2 = 0;
+		for (int k = 0; k < 3; k++) {
+			const double d = fmax(fmax(nd.mn.s[k] - p.s[k], p.s[k] - nd.mx.s[k]), 0);
+			d2 += d*d;
+		}
+		return d2;
 	}
 
-	TopoDS_Shape fuse_all()
+	/* squared distance from p to the closest triangle of a leaf; both
+	 * sides of every select are computed so the loop has no branches */
+	double leaf_dist2(int first, int count, const v3& p) const
 	{
-		if (children.size() == 0) return TopoDS_Shape();
-		TopoDS_Shape r = children[0]->build_shape_rec();
-		for (int i = 1; i < children.size(); i++) {
-			r = BRepAlgoAPI_Fuse(r, children[i]->build_shape_rec());
+		const double* SOA_RESTRICT ax_ = a.x.data() + first;
+		const double* SOA_RESTRICT ay_ = a.y.data() + first;
+		const double* SOA_RESTRICT az_ = a.z.data() + first;
+		const double* SOA_RESTRICT bax = ba.x.data() + first;
+		const double* SOA_RESTRICT bay = ba.y.data() + first;
+		const double* SOA_RESTRICT baz = ba.z.data() + first;
+		const double* SOA_RESTRICT cbx = cb.x.data() + first;
+		const double* SOA_RESTRICT cby = cb.y.data() + first;
+		const double* SOA_RESTRICT cbz = cb.z.data() + first;
+		const double* SOA_RESTRICT acx = ac.x.data() + first;
+		const double* SOA_RESTRICT acy = ac.y.data() + first;
+		const double* SOA_RESTRICT acz = ac.z.data() + first;
+		const double* SOA_RESTRICT nx = n.x.data() + first;
+		const double* SOA_RESTRICT ny = n.y.data() + first;
+		const double* SOA_RESTRICT nz = n.z.data() + first;
+		const double* SOA_RESTRICT iba = inv_ba.data() + first;
+		const double* SOA_RESTRICT icb = inv_cb.data() + first;
+		const double* SOA_RESTRICT iac = inv_ac.data() + first;
+		const double* SOA_RESTRICT inn = inv_nn.data() + first;
+		auto clamp01 = [](double t) { return fmin(fmax(t, 0.0), 1.0); };
+		auto sgn = [](double v) { return (double)((v > 0) - (v < 0)); };
+		double best = INFINITY;
+		for (int i = 0; i < count; i++) {
+			const double pax = p.x-ax_[i], pay = p.y-ay_[i], paz = p.z-az_[i];
+			const double pbx = pax-bax[i], pby = pay-bay[i], pbz = paz-baz[i];
+			const double pcx = pax+acx[i], pcy = pay+acy[i], pcz = paz+acz[i];
+
+			/* inside the prism over the triangle if p is on the inner side
+			 * of all three edge planes */
+			auto side = [&](double ex, double ey, double ez, double qx, double qy, double qz) {
+				const double cx = ey*nz[i] - ez*ny[i], cy = ez*nx[i] - ex*nz[i], cz = ex*ny[i] - ey*nx[i];
+				return sgn(cx*qx + cy*qy + cz*qz);
+			};
+			const double sides = side(bax[i], bay[i], baz[i], pax, pay, paz)
+				+ side(cbx[i], cby[i], cbz[i], pbx, pby, pbz)
+				+ side(acx[i], acy[i], acz[i], pcx, pcy, pcz);
+
+			auto edge2 = [&](double ex, double ey, double ez, double qx, double qy, double qz, double inv_e) {
+				const double t = clamp01((ex*qx + ey*qy + ez*qz) * inv_e);
+				const double dx = ex*t-qx, dy = ey*t-qy, dz = ez*t-qz;
+				return dx*dx + dy*dy + dz*dz;
+			};
+			const double to_edges = fmin(fmin(
+				edge2(bax[i], bay[i], baz[i], pax, pay, paz, iba[i]),
+				edge2(cbx[i], cby[i], cbz[i], pbx, pby, pbz, icb[i])),
+				edge2(acx[i], acy[i], acz[i], pcx, pcy, pcz, iac[i]));
+			const double np = nx[i]*pax + ny[i]*pay + nz[i]*paz;
+			const double to_plane = np*np*inn[i];
+
+			best = fmin(best, sides < 2 ? to_edges : to_plane);
 		}
-		return r;
+		return best;
 	}
 
-	bool is_transform()
+	/* squared distance from p to the mesh if it is below best2, else
+	 * best2; a bound from a nearby point saves most of the traversal */
+	double closest2(const v3& p, double best2) const
 	{
-		switch (type) {
-		case TRANSLATE:
-		case ROTATE:
-			return true;
-		default:
-			return false;
+		if (nodes.empty()) return best2;
+		int stack[64];
+		int sp = 0;
+		stack[sp++] = 0;
+		while (sp > 0) {
+			const int ni = stack[--sp];
+			const bvh_node& nd = nodes[ni];
+			if (box_dist2(nd, p) >= best2) continue;
+			if (nd.count > 0) {
+				best2 = fmin(best2, leaf_dist2(nd.first, nd.count, p));
+				continue;
+			}
+			/* nearer child on top */
+			const int l = ni+1, r = nd.right;
+			const bool left_first = box_dist2(nodes[l], p) <= box_dist2(nodes[r], p);
+			stack[sp++] = left_first ? r : l;
+			stack[sp++] = left_first ? l : r;
 		}
+		return best2;
 	}
+};
 
-	gp_Trsf get_transform()
-	{
-		switch (type) {
-		case TRANSLATE: {
-			gp_Trsf tx;
-			tx.SetTranslation(gp_Vec(translate.v.x, translate.v.y, translate.v.z));
-			return tx;
+/* the triangles whose (y,z) projection covers a ray along +x through
+ * (y,z), each as where the ray crosses it and +1/-1 for the way it
+ * faces. Edge functions are taken relative to the ray, so an edge shared
+ * by two triangles gives exactly opposite values in each, and a ray
+ * through an edge or vertex is counted once, as in watertight
+ * rasterization */
+static void ray_crossings(const soa3& pos, const triangle* tris, const std::vector<int>& candidates, double y, double z, std::vector<std::pair<double,int>>& out)
+{
+	out.clear();
+	for (int i = 0; i < candidates.size(); i++) {
+		const triangle& t = tris[candidates[i]];
+		const int vs[3] = { t.v0, t.v1, t.v2 };
+		double e[3];
+		for (int k = 0; k < 3; k++) {
+			const int p = vs[(k+1)%3], q = vs[(k+2)%3];
+			e[k] = (pos.y[p]-y)*(pos.z[q]-z) - (pos.z[p]-z)*(pos.y[q]-y);
 		}
-
-		case ROTATE: {
-			gp_Trsf tx;
-			tx.SetRotation(
-				gp_Ax1(gp_Pnt(), gp_Dir(rotate.axis.x, rotate.axis.y, rotate.axis.z)),
-				deg2rad(rotate.degrees)
-			);
-			return tx;
+		const double area = e[0] + e[1] + e[2];
+		if (area == 0) continue;
+		const int s = area > 0 ? 1 : -1;
+
+		bool covered = true;
+		for (int k = 0; k < 3 && covered; k++) {
+			if (e[k]*s > 0) continue;
+			if (e[k]*s < 0) {
+				covered = false;
+				continue;
+			}
+			/* on the edge: it belongs to one side, by its direction
+			 * with the triangle made counter-clockwise */
+			const int p = vs[(k+1)%3], q = vs[(k+2)%3];
+			const double dy = (pos.y[q]-pos.y[p])*s, dz = (pos.z[q]-pos.z[p])*s;
+			covered = dz > 0 || (dz == 0 && dy > 0);
 		}
+		if (!covered) continue;
 
-		default:
-			assert(!"not a transform");
-		}
+		const double x = (e[0]*pos.x[vs[0]] + e[1]*pos.x[vs[1]] + e[2]*pos.x[vs[2]]) / area;
+		out.push_back(std::make_pair(x, s));
 	}
+	std::sort(out.begin(), out.end());
+}
 
-	TopoDS_Shape build_shape_rec()
-	{
-		switch (type) {
-		case MKOBJ:
-		case GROUP:
-			return build_group_shape();
+/* writes <name>.sdf with res voxels across the longest side of the mesh
+ * plus SDF_PADDING on every side. Inside is where the winding number of
+ * a ray along +x is nonzero, so overlapping closed parts count as their
+ * union; meshes opened by cull volumes have no reliable inside. Rows of
+ * the grid are baked on up to max_jobs threads */
+static void write_sdf(const mesh_view& mesh, const char* name, int res, int max_jobs)
+{
+	scope_timer ST("write sdf");
 
-		case TRANSLATE:
+	if (res < 1) {
+		fprintf(stderr, "invalid --write-sdf resolution: %d\n", res);
+		exit(EXIT_FAILURE);
+	}
+
+	soa3 zup, pos;
+	soa_load(mesh.vertices, mesh.n_vertices, zup);
+	soa_swizzle_yup(zup, pos);
+
+	v3 mn, mx;
+	soa_bounds(pos, mn, mx);
+	if (mesh.n_triangles == 0 || mn.x > mx.x) {
+		mn = mx = v3();
+	}
+	double extent = 0;
+	for (int k = 0; k < 3; k++) extent = fmax(extent, mx.s[k] - mn.s[k]);
+	const double size = extent > 0 ? extent / res : 1;
+	int dims[3];
+	v3 origin;
+	for (int k = 0; k < 3; k++) {
+		dims[k] = (int)ceil((mx.s[k] - mn.s[k]) / size - 1e-9) + 1 + 2*SDF_PADDING;
+		origin.s[k] = (mn.s[k] + mx.s[k]) / 2 - (dims[k]-1) * size / 2;
+	}
+	const int nx = dims[0], ny = dims[1], nz = dims[2];
+
+	tri_bvh bvh;
+	bvh.build(pos, mesh.triangles, mesh.n_triangles);
+
+	/* triangles by the rows along x whose ray can cross them */
+	std::vector<std::vector<int>> rows(ny*nz);
+	for (int i = 0; i < mesh.n_triangles; i++) {
+		const triangle& t = mesh.triangles[i];
+		const double y0 = fmin(pos.y[t.v0], fmin(pos.y[t.v1], pos.y[t.v2]));
+		const double y1 = fmax(pos.y[t.v0], fmax(pos.y[t.v1], pos.y[t.v2]));
+		const double z0 = fmin(pos.z[t.v0], fmin(pos.z[t.v1], pos.z[t.v2]));
+		const double z1 = fmax(pos.z[t.v0], fmax(pos.z[t.v1], pos.z[t.v2]));
+		/* a row more on each side, as the division may round either way;
+		 * ray_crossings() makes the exact test */
+		const int j0 = std::max(0, (int)ceil((y0 - origin.y) / size) - 1);
+		const int j1 = std::min(ny-1, (int)floor((y1 - origin.y) / size) + 1);
+		const int k0 = std::max(0, (int)ceil((z0 - origin.z) / size) - 1);
+		const int k1 = std::min(nz-1, (int)floor((z1 - origin.z) / size) + 1);
+		for (int k = k0; k <= k1; k++) for (int j = j0; j <= j1; j++) rows[j + k*ny].push_back(i);
+	}
+
+	std::vector<float> dist((size_t)nx*ny*nz);
+	auto bake = [&](int first) {
+		std::vector<std::pair<double,int>> crossings;
+		for (int r = first; r < ny*nz; r += max_jobs) {
+			const int j = r % ny, k = r / ny;
+			const double y = origin.y + j*size, z = origin.z + k*size;
+			ray_crossings(pos, mesh.triangles, rows[r], y, z, crossings);
+			int winding = 0;
+			for (int i = 0; i < crossings.size(); i++) winding += crossings[i].second;
+
+			float* out = &dist[(size_t)r * nx];
+			int next = 0;
+			double prev = -1;
+			for (int i = 0; i < nx; i++) {
+				const v3 p(origin.x + i*size, y, z);
+				/* distances change at most as fast as p moves */
+				const double bound = prev < 0 ? INFINITY : (prev + size) * (1 + 1e-9);
+				const double d = sqrt(bvh.closest2(p, bound*bound));
+				prev = d;
+				/* winding of the crossings still ahead of p */
+				while (next < crossings.size() && crossings[next].first <= p.x) winding -= crossings[next++].second;
+				out[i] = winding != 0 ? -d : d;
+			}
+		}
+	};
+	if (max_jobs > ny*nz) max_jobs = ny*nz;
+	if (max_jobs < 1) max_jobs = 1;
+	std::vector<std::thread> threads;
+	for (int t = 1; t < max_jobs; t++) threads.push_back(std::thread(bake, t));
+	bake(0);
+	for (int t = 0; t < threads.size(); t++) threads[t].join();
+
+	sdf_header h;
+	memcpy(h.magic, SDF_MAGIC, 4);
+	h.version = SDF_VERSION;
+	h.nx = nx;
+	h.ny = ny;
+	h.nz = nz;
+	for (int k = 0; k < 3; k++) h.origin[k] = origin.s[k];
+	h.voxel_size = size;
+
+	char* filename = str_concat(name, ".sdf");
+	FILE* f = fopen_for_write(filename);
+	bool ok = fwrite(&h, sizeof h, 1, f) == 1
+		&& fwrite(dist.data(), sizeof(float), dist.size(), f) == dist.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "%s: write failed\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	free(filename);
+
+	printf("sdf: %dx%dx%d voxels of %g\n", nx, ny, nz, size);
+}
+
+/* quadric error metric (Garland & Heckbert); symmetric 4x4 stored as
+ * xx xy xz xw yy yz yw zz zw ww */
+struct quadric {
+	double a[10];
+	double weight; // of all its planes, so error()/weight is a squared distance
+
+	quadric() : weight(0) { for (int i = 0; i < 10; i++) a[i] = 0; }
+
+	void add_plane(const v3& n, double d, double w)
+	{
+		weight += w;
+		a[0] += w*n.x*n.x; a[1] += w*n.x*n.y; a[2] += w*n.x*n.z; a[3] += w*n.x*d;
+		a[4] += w*n.y*n.y; a[5] += w*n.y*n.z; a[6] += w*n.y*d;
+		a[7] += w*n.z*n.z; a[8] += w*n.z*d;
+		a[9] += w*d*d;
+	}
+
+	void add(const quadric& o)
+	{
+		for (int i = 0; i < 10; i++) a[i] += o.a[i];
+		weight += o.weight;
+	}
+
+	double error(const v3& v) const
+	{
+		return
+			a[0]*v.x*v.x + 2*a[1]*v.x*v.y + 2*a[2]*v.x*v.z + 2*a[3]*v.x
+			+ a[4]*v.y*v.y + 2*a[5]*v.y*v.z + 2*a[6]*v.y
+			+ a[7]*v.z*v.z + 2*a[8]*v.z
+			+ a[9];
+	}
+
+	/* position minimizing the error; false if the system is singular */
+	bool optimum(v3& v) const
+	{
+		const double det =
+			a[0]*(a[4]*a[7] - a[5]*a[5])
+			- a[1]*(a[1]*a[7] - a[5]*a[2])
+			+ a[2]*(a[1]*a[5] - a[4]*a[2]);
+		if (fabs(det) < 1e-12) return false;
+		const double bx = -a[3], by = -a[6], bz = -a[8];
+		v.x = (bx*(a[4]*a[7] - a[5]*a[5]) - a[1]*(by*a[7] - a[5]*bz) + a[2]*(by*a[5] - a[4]*bz)) / det;
+		v.y = (a[0]*(by*a[7] - bz*a[5]) - bx*(a[1]*a[7] - a[5]*a[2]) + a[2]*(a[1]*bz - by*a[2])) / det;
+		v.z = (a[0]*(a[4]*bz - a[5]*by) - a[1]*(a[1]*bz - by*a[2]) + bx*(a[1]*a[5] - a[4]*a[2])) / det;
+		return true;
+	}
+};
+
+/* edge-collapse simplification down to target_triangles, or until the next
+ * collapse would put a vertex more than max_error (RMS, area-weighted) off
+ * the planes of the triangles it replaces (0 disables either limit). Boundary edges and edges between different source faces get
+ * heavily weighted constraint planes so silhouettes and sharp features
+ * survive. */
+static mesh* decimate_mesh(const mesh* in, int target_triangles, double max_error)
+{
+	scope_timer ST("decimate mesh");
+
+	const int nv = in->vertices.size();
+	std::vector<v3> pos(in->vertices);
+	std::vector<triangle> tris;
+	tris.reserve(in->triangles.size());
+	for (int i = 0; i < in->triangles.size(); i++) {
+		const triangle& t = in->triangles[i];
+		if (t.v0 == t.v1 || t.v1 == t.v2 || t.v2 == t.v0) continue;
+		tris.push_back(t);
+	}
+
+	auto tri_vertex = [&](int t, int k) -> int& {
+		return k == 0 ? tris[t].v0 : k == 1 ? tris[t].v1 : tris[t].v2;
+	};
+	auto tri_normal = [&](int t) -> v3 {
+		return (pos[tris[t].v1]-pos[tris[t].v0]).cross(pos[tris[t].v2]-pos[tris[t].v0]);
+	};
+
+	std::vector<quadric> quadrics(nv);
+	std::vector<std::vector<int>> vertex_tris(nv);
+	for (int t = 0; t < tris.size(); t++) {
+		v3 n = tri_normal(t);
+		const double area2 = n.length();
+		if (area2 > 0) {
+			n = n / area2;
+			for (int k = 0; k < 3; k++) quadrics[tri_vertex(t,k)].add_plane(n, -n.dot(pos[tri_vertex(t,0)]), area2/2);
+		}
+		for (int k = 0; k < 3; k++) vertex_tris[tri_vertex(t,k)].push_back(t);
+	}
+	/* just the surface planes, for max_error; the feature planes below
+	 * are weighted to steer collapses and would swamp it */
+	std::vector<quadric> surface = quadrics;
+
+	/* constraint planes along boundary and feature edges */
+	{
+		struct half_edge { int a, b, t; };
+		std::vector<half_edge> edges;
+		edges.reserve(tris.size()*3);
+		for (int t = 0; t < tris.size(); t++) {
+			for (int k = 0; k < 3; k++) {
+				int a = tri_vertex(t,k), b = tri_vertex(t,(k+1)%3);
+				if (a > b) std::swap(a, b);
+				half_edge e = {a, b, t};
+				edges.push_back(e);
+			}
+		}
+		std::sort(edges.begin(), edges.end(), [](const half_edge& x, const half_edge& y) {
+			return x.a != y.a ? x.a < y.a : x.b < y.b;
+		});
+		const double feature_weight = 1000;
+		for (int i = 0; i < edges.size();) {
+			int j = i;
+			bool is_feature = false;
+			while (j < edges.size() && edges[j].a == edges[i].a && edges[j].b == edges[i].b) {
+				if (tris[edges[j].t].face_id != tris[edges[i].t].face_id) is_feature = true;
+				j++;
+			}
+			if (j-i == 1) is_feature = true;
+			if (is_feature) {
+				const v3 pa = pos[edges[i].a], pb = pos[edges[i].b];
+				const v3 ev = pb - pa;
+				const double len2 = ev.dot(ev);
+				for (int k = i; k < j; k++) {
+					v3 n = ev.cross(tri_normal(edges[k].t));
+					if (n.length() == 0 || len2 == 0) continue;
+					n = n.unit();
+					quadrics[edges[i].a].add_plane(n, -n.dot(pa), feature_weight*len2);
+					quadrics[edges[i].b].add_plane(n, -n.dot(pa), feature_weight*len2);
+				}
+			}
+			i = j;
+		}
+	}
+
+	struct candidate {
+		double cost;
+		double distance2; // area-weighted mean squared distance to the surface planes; what max_error bounds
+		int a, b;
+		unsigned stamp_a, stamp_b;
+		v3 p;
+		bool operator<(const candidate& o) const { return cost > o.cost; }
+	};
+
+	std::vector<unsigned> stamps(nv, 0);
+	std::vector<bool> vertex_dead(nv, false);
+	std::vector<bool> tri_dead(tris.size(), false);
+	std::priority_queue<candidate> heap;
+
+	auto push_edge = [&](int a, int b) {
+		quadric q = quadrics[a];
+		q.add(quadrics[b]);
+		candidate c;
+		c.a = a;
+		c.b = b;
+		c.stamp_a = stamps[a];
+		c.stamp_b = stamps[b];
+		if (!q.optimum(c.p)) {
+			const v3 options[3] = { pos[a], pos[b], (pos[a]+pos[b])/2 };
+			c.p = options[0];
+			for (int i = 1; i < 3; i++) if (q.error(options[i]) < q.error(c.p)) c.p = options[i];
+		}
+		c.cost = fmax(0, q.error(c.p));
+		quadric sq = surface[a];
+		sq.add(surface[b]);
+		c.distance2 = sq.weight > 0 ? fmax(0, sq.error(c.p)) / sq.weight : 0;
+		heap.push(c);
+	};
+
+	auto neighbours = [&](int v, std::vector<int>& out) {
+		out.clear();
+		for (int i = 0; i < vertex_tris[v].size(); i++) {
+			int t = vertex_tris[v][i];
+			if (tri_dead[t]) continue;
+			for (int k = 0; k < 3; k++) {
+				int o = tri_vertex(t,k);
+				if (o != v && std::find(out.begin(), out.end(), o) == out.end()) out.push_back(o);
+			}
+		}
+	};
+
+	std::vector<int> na, nb;
+	for (int v = 0; v < nv; v++) {
+		neighbours(v, na);
+		for (int i = 0; i < na.size(); i++) if (v < na[i]) push_edge(v, na[i]);
+	}
+
+	/* would moving v to p (with its partner gone) flip or collapse any of
+	 * the triangles that survive? */
+	auto flips = [&](int v, int other, const v3& p) -> bool {
+		for (int i = 0; i < vertex_tris[v].size(); i++) {
+			int t = vertex_tris[v][i];
+			if (tri_dead[t]) continue;
+			int vs[3] = { tris[t].v0, tris[t].v1, tris[t].v2 };
+			if (vs[0] == other || vs[1] == other || vs[2] == other) continue;
+			v3 before = tri_normal(t);
+			v3 ps[3];
+			for (int k = 0; k < 3; k++) ps[k] = vs[k] == v ? p : pos[vs[k]];
+			v3 after = (ps[1]-ps[0]).cross(ps[2]-ps[0]);
+			const double la = after.length(), lb = before.length();
+			if (la < 1e-12 * (1 + lb)) return true;
+			if (before.dot(after) < 0.2 * la * lb) return true;
+		}
+		return false;
+	};
+
+	int n_live = tris.size();
+	/* the raw cost grows with the model (planes are weighted by area),
+	 * so the bound is on the RMS distance of the merged vertex to the
+	 * planes of the triangles it replaces, each weighted by its area */
+	const double max_distance2 = max_error > 0 ? max_error*max_error : INFINITY;
+	while (!heap.empty() && (target_triangles <= 0 || n_live > target_triangles)) {
+		candidate c = heap.top();
+		heap.pop();
+		if (vertex_dead[c.a] || vertex_dead[c.b]) continue;
+		if (stamps[c.a] != c.stamp_a || stamps[c.b] != c.stamp_b) continue;
+		/* not the end: the heap is ordered by cost, not distance, so
+		 * later edges may still be near enough; this one is pushed
+		 * again if either end changes */
+		if (c.distance2 > max_distance2) continue;
+
+		/* link condition; more shared neighbours than shared triangles
+		 * means the collapse would pinch the surface */
+		neighbours(c.a, na);
+		neighbours(c.b, nb);
+		int n_common = 0;
+		for (int i = 0; i < na.size(); i++) {
+			if (std::find(nb.begin(), nb.end(), na[i]) != nb.end()) n_common++;
+		}
+		int n_shared = 0;
+		for (int i = 0; i < vertex_tris[c.a].size(); i++) {
+			int t = vertex_tris[c.a][i];
+			if (tri_dead[t]) continue;
+			if (tris[t].v0 == c.b || tris[t].v1 == c.b || tris[t].v2 == c.b) n_shared++;
+		}
+		if (n_common > n_shared) continue;
+		if (flips(c.a, c.b, c.p) || flips(c.b, c.a, c.p)) continue;
+
+		/* collapse b into a */
+		pos[c.a] = c.p;
+		quadrics[c.a].add(quadrics[c.b]);
+		surface[c.a].add(surface[c.b]);
+		vertex_dead[c.b] = true;
+		for (int i = 0; i < vertex_tris[c.b].size(); i++) {
+			int t = vertex_tris[c.b][i];
+			if (tri_dead[t]) continue;
+			if (tris[t].v0 == c.a || tris[t].v1 == c.a || tris[t].v2 == c.a) {
+				tri_dead[t] = true;
+				n_live--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++) if (tri_vertex(t,k) == c.b) tri_vertex(t,k) = c.a;
+			vertex_tris[c.a].push_back(t);
+		}
+		std::vector<int>().swap(vertex_tris[c.b]);
+
+		std::vector<int>& at = vertex_tris[c.a];
+		at.erase(std::remove_if(at.begin(), at.end(), [&](int t) { return (bool)tri_dead[t]; }), at.end());
+
+		stamps[c.a]++;
+		neighbours(c.a, na);
+		for (int i = 0; i < na.size(); i++) push_edge(c.a, na[i]);
+	}
+
+	/* compact into a fresh mesh with flat normals */
+	mesh* m = new mesh;
+	std::vector<int> remap(nv, -1);
+	std::map<v3,int,v3_less> normal_map;
+	for (int t = 0; t < tris.size(); t++) {
+		if (tri_dead[t]) continue;
+		triangle tri = tris[t];
+		for (int k = 0; k < 3; k++) {
+			int& v = k == 0 ? tri.v0 : k == 1 ? tri.v1 : tri.v2;
+			if (remap[v] < 0) {
+				remap[v] = m->vertices.size();
+				m->vertices.push_back(pos[v]);
+			}
+			v = remap[v];
+		}
+		v3 n = (m->vertices[tri.v1]-m->vertices[tri.v0]).cross(m->vertices[tri.v2]-m->vertices[tri.v0]);
+		if (n.length() == 0) continue;
+		n = n.unit();
+		if (normal_map.count(n) == 0) {
+			normal_map[n] = m->normals.size();
+			m->normals.push_back(n);
+		}
+		tri.n = normal_map[n];
+		m->triangles.push_back(tri);
+	}
+
+	printf("decimated %d -> %d triangles\n", (int)in->triangles.size(), (int)m->triangles.size());
+
+	return m;
+}
+
+/* accumulates triangles into a mesh, merging identical vertices, and
+ * identical normals within a face; culled triangles are dropped */
+struct mesh_builder {
+	mesh* m;
+	std::map<v3,int,v3_less> vertex_map;
+	std::map<v3,int,v3_less> normal_map;
+	int face_id;
+
+	mesh_builder(mesh* m) : m(m), face_id(0) {}
+
+	void begin_face()
+	{
+		face_id++;
+		normal_map.clear();
+	}
+
+	int vertex(const v3& p)
+	{
+		auto it = vertex_map.find(p);
+		if (it != vertex_map.end()) return it->second;
+		int i = m->vertices.size();
+		vertex_map[p] = i;
+		m->vertices.push_back(p);
+		return i;
+	}
+
+	void add_triangle(const v3& p0, const v3& p1, const v3& p2)
+	{
+		if (is_culled(p0, p1, p2)) return;
+
+		v3 normal = (p1-p0).cross(p2-p0);
+		if (normal.length() == 0) return;
+		add_triangle(p0, p1, p2, normal.unit());
+	}
+
+	/* for callers that did the culling and the unit normal themselves */
+	void add_triangle(const v3& p0, const v3& p1, const v3& p2, const v3& normal)
+	{
+		triangle tri;
+		tri.v0 = vertex(p0);
+		tri.v1 = vertex(p1);
+		tri.v2 = vertex(p2);
+		tri.face_id = face_id;
+
+		auto it = normal_map.find(normal);
+		if (it != normal_map.end()) {
+			tri.n = it->second;
+		} else {
+			tri.n = normal_map[normal] = m->normals.size();
+			m->normals.push_back(normal);
+		}
+
+		m->triangles.push_back(tri);
+	}
+};
+
+struct glb_object {
+	const char* name;
+	const char* instance_marker;
+	mesh_view mesh;
+};
+std::vector<glb_object> glb_objects;
+
+char* run_write_obj = NULL;
+char* run_write_glb = NULL;
+char* run_write_meshlets = NULL;
+char* run_write_sdf = NULL;
+char* run_write_brep = NULL;
+bool run_dump = false;
+bool run_preview = false;
+char* run_preview_res = NULL;
+std::vector<char*> run_only;
+char* run_markers_out = NULL;
+char* run_decimate = NULL;
+char* run_decimate_error = NULL;
+char* run_lods = NULL;
+bool run_isolate = false;
+char* run_jobs = NULL;
+char* run_budget = NULL;
+char* run_deadline = NULL;
+bool run_progress = false;
+bool run_unify = false;
+bool run_unify_booleans = false;
+char* run_tile_booleans = NULL;
+bool run_low_memory = false;
+bool run_pipeline = false;
+char* run_write_ir = NULL;
+char* run_write_ir_text = NULL;
+char* run_face_cache = NULL;
+char* run_mesh_cache = NULL;
+
+/* --jobs, or one per core */
+static int job_limit()
+{
+	int n = run_jobs ? atoi(run_jobs) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n;
+}
+
+enum node_type {
+	MKOBJ = 1,
+	GROUP,
+	TRANSLATE,
+	ROTATE,
+	CUT,
+	COMMON,
+	FUSE,
+	FILLET,
+	RESOLUTION,
+	BOX,
+	WEDGE,
+	SPHERE,
+	CYLINDER,
+	CONE,
+	IMPORT_BREP,
+
+	FACE,
+	MOVE_TO,
+	LINE_TO,
+	CIRCLE_ARC_TO,
+	PRISM,
+	MIRROR,
+	SYMMETRIC,
+	PATTERN_LINEAR,
+	PATTERN_POLAR,
+	CIRCLE,
+	REVOLVE,
+	SHELL,
+	OFFSET,
+};
+
+/* names used by the IR text form; NULL past the last type */
+static const char* node_type_name(int type)
+{
+	switch (type) {
+	case MKOBJ: return "mkobj";
+	case GROUP: return "group";
+	case TRANSLATE: return "translate";
+	case ROTATE: return "rotate";
+	case CUT: return "cut";
+	case COMMON: return "common";
+	case FUSE: return "fuse";
+	case FILLET: return "fillet";
+	case RESOLUTION: return "resolution";
+	case BOX: return "box";
+	case WEDGE: return "wedge";
+	case SPHERE: return "sphere";
+	case CYLINDER: return "cylinder";
+	case CONE: return "cone";
+	case IMPORT_BREP: return "import_brep";
+	case FACE: return "face";
+	case MOVE_TO: return "move_to";
+	case LINE_TO: return "line_to";
+	case CIRCLE_ARC_TO: return "circle_arc_to";
+	case PRISM: return "prism";
+	case MIRROR: return "mirror";
+	case SYMMETRIC: return "symmetric";
+	case PATTERN_LINEAR: return "pattern_linear";
+	case PATTERN_POLAR: return "pattern_polar";
+	case CIRCLE: return "circle";
+	case REVOLVE: return "revolve";
+	case SHELL: return "shell";
+	case OFFSET: return "offset";
+	}
+	return NULL;
+}
+
+static v3 gp_Pnt_to_v3(const gp_Pnt& p)
+{
+	return v3(p.X(), p.Y(), p.Z());
+}
+
+static gp_Pnt v3_to_gp_Pnt(const v3& v)
+{
+	return gp_Pnt(v.x, v.y, v.z);
+}
+
+/* row-major 3x4 matrix for the soa_*() kernels */
+static void trsf_matrix(const gp_Trsf& tx, double m[12])
+{
+	for (int row = 1; row <= 3; row++) {
+		for (int col = 1; col <= 4; col++) {
+			m[(row-1)*4 + (col-1)] = tx.Value(row, col);
+		}
+	}
+}
+
+static void dump_gp_Trsf(const gp_Trsf& tx)
+{
+	for (int row = 1; row <= 3; row++) {
+		for (int col = 1; col <= 4; col++) {
+			printf("%.3f ", tx.Value(row, col));
+		}
+		printf("\n");
+	}
+}
+
+/* --preview evaluates the tree on a voxel grid instead of building BRep
+ * shapes; leaves are rasterized by point-inside tests at voxel centers, and
+ * cut/fuse/common become per-voxel boolean ops, which is blocky but fast */
+struct voxel_grid {
+	int nx, ny, nz;
+	v3 origin;
+	double size;
+	std::vector<unsigned char> cells;
+
+	void init(const v3& mn, const v3& mx, int resolution)
+	{
+		v3 ext = mx - mn;
+		size = fmax(ext.x, fmax(ext.y, ext.z)) / resolution;
+		if (size <= 0) size = 1;
+		origin = mn - v3(size, size, size);
+		nx = (int)ceil(ext.x / size) + 2;
+		ny = (int)ceil(ext.y / size) + 2;
+		nz = (int)ceil(ext.z / size) + 2;
+		cells.assign((size_t)nx*ny*nz, 0);
+	}
+
+	voxel_grid empty_like() const
+	{
+		voxel_grid g;
+		g.nx = nx; g.ny = ny; g.nz = nz;
+		g.origin = origin;
+		g.size = size;
+		g.cells.assign(cells.size(), 0);
+		return g;
+	}
+
+	size_t index(int x, int y, int z) const
+	{
+		return ((size_t)z*ny + y)*nx + x;
+	}
+
+	bool get(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= nx || y >= ny || z >= nz) return false;
+		return cells[index(x,y,z)];
+	}
+
+	void apply(const voxel_grid& other, bool value)
+	{
+		for (size_t i = 0; i < cells.size(); i++) {
+			if (other.cells[i]) cells[i] = value;
+		}
+	}
+
+	/* squared distances, in voxels, from every cell center to the
+	 * nearest one that is set (or clear, for !set); exact Euclidean
+	 * distances, one axis at a time (Felzenszwalb & Huttenlocher) */
+	std::vector<double> distance2_to(bool set) const
+	{
+		const double far = 1e20;
+		std::vector<double> d(cells.size());
+		for (size_t i = 0; i < cells.size(); i++) d[i] = (cells[i] != 0) == set ? 0 : far;
+
+		const int dims[3] = { nx, ny, nz };
+		const size_t strides[3] = { 1, (size_t)nx, (size_t)nx*ny };
+		const int n_max = std::max(nx, std::max(ny, nz));
+		std::vector<double> f(n_max), z(n_max+1);
+		std::vector<int> v(n_max);
+		for (int axis = 0; axis < 3; axis++) {
+			const int n = dims[axis];
+			const size_t stride = strides[axis];
+			for (size_t start = 0; start < d.size(); start++) {
+				/* a line starts at every cell with coordinate 0 on axis */
+				if ((start / stride) % n != 0) continue;
+				for (int q = 0; q < n; q++) f[q] = d[start + q*stride];
+
+				/* lower envelope of the parabolas rooted at each cell */
+				int k = 0;
+				v[0] = 0;
+				z[0] = -INFINITY;
+				z[1] = INFINITY;
+				for (int q = 1; q < n; q++) {
+					double s;
+					for (;;) {
+						const int p = v[k];
+						s = ((f[q] + (double)q*q) - (f[p] + (double)p*p)) / (2.0*(q - p));
+						if (s > z[k]) break;
+						k--;
+					}
+					k++;
+					v[k] = q;
+					z[k] = s;
+					z[k+1] = INFINITY;
+				}
+				k = 0;
+				for (int q = 0; q < n; q++) {
+					while (z[k+1] < q) k++;
+					d[start + q*stride] = (double)(q - v[k])*(q - v[k]) + f[v[k]];
+				}
+			}
+		}
+		return d;
+	}
+
+	/* grows (distance > 0) or shrinks (distance < 0) the set cells by
+	 * |distance|; surfaces lie half a voxel from the cell centers */
+	void grow(double distance)
+	{
+		if (distance == 0) return;
+		const bool grow = distance > 0;
+		const std::vector<double> d2 = distance2_to(grow);
+		const double reach = fabs(distance) / size + 0.5;
+		for (size_t i = 0; i < cells.size(); i++) {
+			if (d2[i] <= reach*reach) cells[i] = grow;
+		}
+	}
+
+	mesh* build_mesh() const
+	{
+		mesh* m = new mesh;
+
+		/* one normal per axis direction; index is axis*2 + (positive?1:0) */
+		for (int axis = 0; axis < 3; axis++) {
+			for (int sign = 0; sign < 2; sign++) {
+				v3 n;
+				n.s[axis] = sign ? 1 : -1;
+				m->normals.push_back(n);
+			}
+		}
+
+		/* lattice point -> vertex index */
+		const int lx = nx+1, ly = ny+1, lz = nz+1;
+		std::vector<int> lattice((size_t)lx*ly*lz, -1);
+		auto vertex = [&](int c[3]) -> int {
+			size_t i = ((size_t)c[2]*ly + c[1])*lx + c[0];
+			if (lattice[i] < 0) {
+				lattice[i] = m->vertices.size();
+				m->vertices.push_back(origin + v3(c[0], c[1], c[2]) * size);
+			}
+			return lattice[i];
+		};
+
+		for (int z = 0; z < nz; z++) for (int y = 0; y < ny; y++) for (int x = 0; x < nx; x++) {
+			if (!cells[index(x,y,z)]) continue;
+			int p[3] = {x,y,z};
+			for (int axis = 0; axis < 3; axis++) {
+				for (int sign = 0; sign < 2; sign++) {
+					int q[3] = {x,y,z};
+					q[axis] += sign ? 1 : -1;
+					if (get(q[0], q[1], q[2])) continue;
+
+					/* quad on the shared side; walking (u,v) with u,v
+					 * following axis cyclically gives an outward +axis
+					 * normal, so reverse it for the negative side */
+					const int u = (axis+1)%3, v = (axis+2)%3;
+					const int uv[4][2] = {{0,0},{1,0},{1,1},{0,1}};
+					int vi[4];
+					for (int k = 0; k < 4; k++) {
+						int c[3] = {p[0],p[1],p[2]};
+						c[axis] += sign;
+						c[u] += uv[sign ? k : 3-k][0];
+						c[v] += uv[sign ? k : 3-k][1];
+						vi[k] = vertex(c);
+					}
+
+					const int tris[2][3] = {{0,1,2},{0,2,3}};
+					for (int k = 0; k < 2; k++) {
+						triangle tri;
+						tri.v0 = vi[tris[k][0]];
+						tri.v1 = vi[tris[k][1]];
+						tri.v2 = vi[tris[k][2]];
+						tri.n = axis*2 + sign;
+						tri.face_id = tri.n;
+						if (is_culled(m->vertices[tri.v0], m->vertices[tri.v1], m->vertices[tri.v2])) continue;
+						m->triangles.push_back(tri);
+					}
+				}
+			}
+		}
+
+		return m;
+	}
+};
+
+/* sets (or clears) every voxel whose center, mapped back through tx, is
+ * inside the local bounding box [mn;mx] and passes inside() */
+template <typename F>
+static void voxel_raster(voxel_grid& g, const gp_Trsf& tx, const v3& mn, const v3& mx, bool value, F inside)
+{
+	v3 wmn(INFINITY, INFINITY, INFINITY), wmx(-INFINITY, -INFINITY, -INFINITY);
+	for (int i = 0; i < 8; i++) {
+		gp_Pnt c((i&1) ? mx.x : mn.x, (i&2) ? mx.y : mn.y, (i&4) ? mx.z : mn.z);
+		c.Transform(tx);
+		v3 w(c.X(), c.Y(), c.Z());
+		for (int j = 0; j < 3; j++) {
+			wmn.s[j] = fmin(wmn.s[j], w.s[j]);
+			wmx.s[j] = fmax(wmx.s[j], w.s[j]);
+		}
+	}
+
+	int i0[3], i1[3];
+	const int dims[3] = {g.nx, g.ny, g.nz};
+	for (int j = 0; j < 3; j++) {
+		i0[j] = (int)fmax(0, floor((wmn.s[j] - g.origin.s[j]) / g.size - 0.5));
+		i1[j] = (int)fmin(dims[j]-1, ceil((wmx.s[j] - g.origin.s[j]) / g.size - 0.5));
+	}
+
+	gp_Trsf inv = tx.Inverted();
+	double m[3][4];
+	for (int row = 0; row < 3; row++) {
+		for (int col = 0; col < 4; col++) {
+			m[row][col] = inv.Value(row+1, col+1);
+		}
+	}
+
+	for (int z = i0[2]; z <= i1[2]; z++) for (int y = i0[1]; y <= i1[1]; y++) for (int x = i0[0]; x <= i1[0]; x++) {
+		v3 w = g.origin + v3(x+0.5, y+0.5, z+0.5) * g.size;
+		v3 p;
+		for (int row = 0; row < 3; row++) {
+			p.s[row] = m[row][0]*w.x + m[row][1]*w.y + m[row][2]*w.z + m[row][3];
+		}
+		if (inside(p)) g.cells[g.index(x,y,z)] = value;
+	}
+}
+
+/* planar polygon in its own 2D frame; used for inside tests on prisms.
+ * Holes are extra loops, which the even-odd test handles as they are */
+struct flat_polygon {
+	v3 o, u, w, n;
+	std::vector<double> xs, ys;
+	std::vector<int> loop_end; // loop i ends before loop_end[i]
+
+	void init(const std::vector<std::vector<v3>>& loops)
+	{
+		init(loops[0]);
+		for (int i = 1; i < loops.size(); i++) {
+			for (int j = 0; j < loops[i].size(); j++) {
+				xs.push_back((loops[i][j]-o).dot(u));
+				ys.push_back((loops[i][j]-o).dot(w));
+			}
+			loop_end.push_back(xs.size());
+		}
+	}
+
+	void init(const std::vector<v3>& pts)
+	{
+		/* Newell's method, robust for concave polygons */
+		n = v3();
+		for (int i = 0; i < pts.size(); i++) {
+			const v3& a = pts[i];
+			const v3& b = pts[(i+1) % pts.size()];
+			n = n + v3((a.y-b.y)*(a.z+b.z), (a.z-b.z)*(a.x+b.x), (a.x-b.x)*(a.y+b.y));
+		}
+		n = n.unit();
+		o = pts[0];
+		u = (fabs(n.x) < 0.9 ? v3(1,0,0) : v3(0,1,0)).cross(n).unit();
+		w = n.cross(u);
+		xs.clear();
+		ys.clear();
+		for (int i = 0; i < pts.size(); i++) {
+			xs.push_back((pts[i]-o).dot(u));
+			ys.push_back((pts[i]-o).dot(w));
+		}
+		loop_end.assign(1, xs.size());
+	}
+
+	/* even-odd test of p projected onto the polygon plane */
+	bool contains(const v3& p) const
+	{
+		const double x = (p-o).dot(u), y = (p-o).dot(w);
+		bool inside = false;
+		for (int k = 0, begin = 0; k < loop_end.size(); begin = loop_end[k++]) {
+			for (int i = begin, j = loop_end[k]-1; i < loop_end[k]; j = i++) {
+				if ((ys[i] > y) != (ys[j] > y) && x < (xs[j]-xs[i]) * (y-ys[i]) / (ys[j]-ys[i]) + xs[i]) {
+					inside = !inside;
+				}
+			}
+		}
+		return inside;
+	}
+};
+
+struct node;
+std::map<node*, TopoDS_Shape> prebuilt_shapes;
+
+/* subtrees without booleans that build_mesh tessellates straight from
+ * the node parameters instead of going through BRep and BRepMesh */
+struct analytic_part {
+	node* n;
+	gp_Trsf tx;
+	double linear_deflection;
+	double angular_deflection;
+};
+thread_local std::vector<analytic_part> analytic_parts;
+
+/* segments needed for a full circle of radius r */
+static int circle_segments(double r, double linear_deflection, bool is_relative, double angular_deflection)
+{
+	double max_angle = angular_deflection > 0 ? angular_deflection : M_PI/4;
+	double lin = is_relative ? linear_deflection * r : linear_deflection;
+	if (lin > 0 && lin < r) max_angle = fmin(max_angle, 2*acos(1 - lin/r));
+	int n = (int)ceil(2*M_PI / max_angle);
+	return n < 3 ? 3 : n;
+}
+
+/* resolution() tags the surfaces of the faces it produces. Booleans
+ * split faces but keep their surfaces, and translate()/rotate() only
+ * change locations, so tags survive them; mirror() and symmetric() copy
+ * geometry, so build_replicated carries the tags over, and --isolate
+ * workers send theirs back with their shape. Tagging is first-come,
+ * which lets the innermost resolution() win. */
+struct face_resolution {
+	double linear_deflection;
+	double angular_deflection;
+};
+
+struct tagged_surface {
+	Handle(Geom_Surface) surface; // keeps the key alive
+	face_resolution res;
+};
+
+thread_local std::map<const Geom_Surface*, tagged_surface> surface_resolutions;
+
+static const face_resolution* find_resolution(const TopoDS_Face& fac)
+{
+	if (surface_resolutions.size() == 0) return NULL;
+	TopLoc_Location location;
+	Handle(Geom_Surface) surface = BRep_Tool::Surface(fac, location);
+	auto it = surface_resolutions.find(surface.get());
+	return it != surface_resolutions.end() ? &it->second.res : NULL;
+}
+
+static void tag_resolution(const TopoDS_Face& fac, const face_resolution& res)
+{
+	TopLoc_Location location;
+	Handle(Geom_Surface) surface = BRep_Tool::Surface(fac, location);
+	if (surface.IsNull() || surface_resolutions.count(surface.get())) return;
+	tagged_surface ts;
+	ts.surface = surface;
+	ts.res = res;
+	surface_resolutions[surface.get()] = ts;
+}
+
+static void carry_resolutions(const TopoDS_Shape& from, BRepBuilderAPI_Transform& mk)
+{
+	if (surface_resolutions.size() == 0) return;
+	for (TopExp_Explorer it(from, TopAbs_FACE); it.More(); it.Next()) {
+		const TopoDS_Face& fac = TopoDS::Face(it.Current());
+		const face_resolution* res = find_resolution(fac);
+		if (res == NULL) continue;
+		const TopoDS_Shape& moved = mk.ModifiedShape(fac);
+		if (moved.IsNull() || moved.ShapeType() != TopAbs_FACE) continue;
+		tag_resolution(TopoDS::Face(moved), *res);
+	}
+}
+
+/* the resolution() tags of shp's faces as (face index, resolution)
+ * records, indexed in TopExp_Explorer order. BinTools::Read() makes new
+ * surfaces, so --isolate workers send these along with their shape */
+static std::string write_resolutions(const TopoDS_Shape& shp)
+{
+	std::string r;
+	if (surface_resolutions.size() == 0) return r;
+	int index = 0;
+	for (TopExp_Explorer it(shp, TopAbs_FACE); it.More(); it.Next(), index++) {
+		const face_resolution* res = find_resolution(TopoDS::Face(it.Current()));
+		if (res == NULL) continue;
+		r.append((const char*)&index, sizeof index);
+		r.append((const char*)res, sizeof *res);
+	}
+	return r;
+}
+
+/* tags the faces of shp (as read back) from write_resolutions() records */
+static void read_resolutions(const TopoDS_Shape& shp, const std::string& data)
+{
+	const size_t record = sizeof(int) + sizeof(face_resolution);
+	std::map<int, face_resolution> tags;
+	for (size_t at = 0; at + record <= data.size(); at += record) {
+		int index;
+		face_resolution res;
+		memcpy(&index, data.data() + at, sizeof index);
+		memcpy(&res, data.data() + at + sizeof index, sizeof res);
+		tags[index] = res;
+	}
+	int index = 0;
+	for (TopExp_Explorer it(shp, TopAbs_FACE); it.More(); it.Next(), index++) {
+		auto tag = tags.find(index);
+		if (tag != tags.end()) tag_resolution(TopoDS::Face(it.Current()), tag->second);
+	}
+}
+
+static int count_faces(const TopoDS_Shape& shp)
+{
+	int n = 0;
+	for (TopExp_Explorer it(shp, TopAbs_FACE); it.More(); it.Next()) n++;
+	return n;
+}
+
+struct unify_counts {
+	int faces_before, faces_after;
+	unify_counts() : faces_before(0), faces_after(0) {}
+} unify_stats;
+
+/* merges faces (and edges) split by booleans that lie on the same
+ * plane/cylinder/etc. back into single faces, so they mesh as one. Edges
+ * and vertices in keep are left as they are, and so are the faces on
+ * either side of a kept edge. A merged face may get a new surface, so
+ * resolution() tags are carried over to it */
+static TopoDS_Shape unify_same_domain(const TopoDS_Shape& shp, const TopTools_MapOfShape* keep = NULL)
+{
+	ShapeUpgrade_UnifySameDomain unify(shp, true, true, false);
+	if (keep) unify.KeepShapes(*keep);
+	unify.Build();
+	unify_stats.faces_before += count_faces(shp);
+	const TopoDS_Shape& r = unify.Shape();
+	unify_stats.faces_after += count_faces(r);
+	if (surface_resolutions.size() == 0) return r;
+	Handle(BRepTools_History) history = unify.History();
+	for (TopExp_Explorer it(shp, TopAbs_FACE); it.More(); it.Next()) {
+		const face_resolution* res = find_resolution(TopoDS::Face(it.Current()));
+		if (res == NULL) continue;
+		for (TopTools_ListIteratorOfListOfShape m(history->Modified(it.Current())); m.More(); m.Next()) {
+			if (m.Value().ShapeType() == TopAbs_FACE) tag_resolution(TopoDS::Face(m.Value()), *res);
+		}
+	}
+	return r;
+}
+
+/* import_brep() files that have been read; keyed by file identity rather
+ * than path so a part imported many times (or through different paths)
+ * is read once, and every use shares the same underlying TShape. A file
+ * rewritten in place gets a new mtime/size and is read again */
+struct brep_file_id {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+
+	bool operator<(const brep_file_id& o) const
+	{
+		if (dev != o.dev) return dev < o.dev;
+		if (ino != o.ino) return ino < o.ino;
+		if (size != o.size) return size < o.size;
+		return mtime < o.mtime;
+	}
+};
+std::map<brep_file_id, TopoDS_Shape> brep_cache;
+
+static const TopoDS_Shape& load_brep(const char* path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	brep_file_id id;
+	id.dev = st.st_dev;
+	id.ino = st.st_ino;
+	id.size = st.st_size;
+	id.mtime = st.st_mtime;
+
+	auto it = brep_cache.find(id);
+	if (it != brep_cache.end()) return it->second;
+
+	scope_timer ST("import brep");
+	TopoDS_Shape& shp = brep_cache[id];
+	if (!BinTools::Read(shp, path) || shp.IsNull()) {
+		fprintf(stderr, "%s: not a binary BRep file\n", path);
+		exit(EXIT_FAILURE);
+	}
+	return shp;
+}
+
+/* progress of the mkobj() being built, counted in nodes (plus one step
+ * for meshing), and the label of the innermost node running */
+struct eval_progress {
+	int done, total;
+	std::string running;
+	eval_progress() : done(0), total(0) {}
+};
+thread_local eval_progress progress;
+
+progress_callback progress_cb = NULL;
+void* progress_usr = NULL;
+
+enum cancel_reason {
+	NOT_CANCELLED = 0,
+	CANCEL_SIGINT,
+	CANCEL_DEADLINE,
+	CANCEL_REQUESTED,
+};
+volatile sig_atomic_t cancel_requested = NOT_CANCELLED;
+bool in_isolated_worker = false;
+stopwatch run_clock;
+
+static void on_sigint(int)
+{
+	cancel_requested = CANCEL_SIGINT;
+	/* a second ^C kills right away */
+	signal(SIGINT, SIG_DFL);
+}
+
+static bool is_cancelled()
+{
+	if (cancel_requested == NOT_CANCELLED && run_deadline && run_clock.time() > atof(run_deadline)) {
+		cancel_requested = CANCEL_DEADLINE;
+	}
+	return cancel_requested != NOT_CANCELLED;
+}
+
+/* sub is how far the running node itself has come, 0..1 */
+static void report_progress(double sub = 0)
+{
+	if (progress_cb == NULL || progress.total == 0) return;
+	double f = fmin(1.0, (progress.done + sub) / progress.total);
+	if (!progress_cb(f, progress.running.c_str(), progress_usr)) cancel_requested = CANCEL_REQUESTED;
+}
+
+thread_local bool on_writer_thread = false;
+static void park_writer_thread();
+
+/* stops the run if a cancel is pending; called between nodes and between
+ * the steps of the expensive ones. Workers just exit and the --pipeline
+ * writer thread stops where it is; the parent/main thread reports */
+static void check_cancel()
+{
+	if (!is_cancelled()) return;
+	if (in_isolated_worker) _exit(EXIT_FAILURE);
+	if (on_writer_thread) park_writer_thread();
+	const char* why =
+		cancel_requested == CANCEL_SIGINT ? "interrupted" :
+		cancel_requested == CANCEL_DEADLINE ? "deadline exceeded" :
+		"cancelled";
+	fflush(stdout);
+	fprintf(stderr, "%s while building %s\n", why, progress.running.c_str());
+	exit(cancel_requested == CANCEL_SIGINT ? 128+SIGINT : EXIT_FAILURE);
+}
+
+static bool print_progress(double fraction, const char* running, void*)
+{
+	fprintf(stderr, "[%3d%%] %s\n", (int)(fraction*100), running);
+	return true;
+}
+
+/* feeds OCCT algorithm progress into report_progress() and lets them
+ * stop early on cancel */
+class eval_progress_indicator : public Message_ProgressIndicator {
+public:
+	Standard_Boolean Show(const Standard_Boolean)
+	{
+		report_progress(GetPosition());
+		return Standard_True;
+	}
+
+	Standard_Boolean UserBreak()
+	{
+		return is_cancelled();
+	}
+};
+
+template <class T> static void build_boolean(T& op, const TopoDS_Shape& a, const TopTools_ListOfShape& tools, BOPAlgo_GlueEnum glue)
+{
+	TopTools_ListOfShape args;
+	args.Append(a);
+	op.SetArguments(args);
+	op.SetTools(tools);
+	op.SetGlue(glue);
+	Handle(Message_ProgressIndicator) pi = new eval_progress_indicator;
+	op.SetProgressIndicator(pi);
+	/* we never ask for Modified()/Generated() */
+	if (run_low_memory) op.SetToFillHistory(false);
+	op.Build();
+}
+
+template <class T> static TopoDS_Shape run_boolean(const TopoDS_Shape& a, const TopTools_ListOfShape& tools, BOPAlgo_GlueEnum glue = BOPAlgo_GlueOff)
+{
+	T op;
+	build_boolean(op, a, tools, glue);
+	check_cancel();
+	return op.Shape();
+}
+
+template <class T> static TopoDS_Shape run_boolean(const TopoDS_Shape& a, const TopoDS_Shape& b)
+{
+	TopTools_ListOfShape tools;
+	tools.Append(b);
+	return run_boolean<T>(a, tools);
+}
+
+/* --tile-booleans: a cut or common with more tools than that is done in
+ * tiles of its target's bounding box. Each tile's slice of the target goes
+ * through the boolean with just the tools touching the tile, on --jobs
+ * threads, and the pieces are glued back together, so the cost follows
+ * how crowded the tools are rather than how many there are */
+struct tile_box {
+	double lo[3], hi[3];
+};
+
+struct boolean_tile {
+	tile_box box;
+	std::vector<int> tools;
+};
+
+static tile_box to_tile_box(const Bnd_Box& bb)
+{
+	tile_box r;
+	bb.Get(r.lo[0], r.lo[1], r.lo[2], r.hi[0], r.hi[1], r.hi[2]);
+	return r;
+}
+
+static bool boxes_overlap(const tile_box& a, const tile_box& b)
+{
+	for (int k = 0; k < 3; k++) {
+		if (a.hi[k] < b.lo[k] || b.hi[k] < a.lo[k]) return false;
+	}
+	return true;
+}
+
+/* splits t across the axis plane that leaves its fuller half with the
+ * fewest tools. The planes tried lie halfway between neighbouring tool box
+ * edges, so they go through as few tools as they can and never along a
+ * box side. False when no plane leaves both halves with fewer tools */
+static bool split_tile(const boolean_tile& t, const std::vector<tile_box>& boxes, boolean_tile& a, boolean_tile& b)
+{
+	const int n = t.tools.size();
+	int best = n, best_axis = -1;
+	double best_at = 0, best_off = 0;
+	for (int k = 0; k < 3; k++) {
+		const double extent = t.box.hi[k] - t.box.lo[k];
+		if (extent <= 0) continue;
+		std::vector<double> los(n), his(n), edges;
+		for (int i = 0; i < n; i++) {
+			const tile_box& tb = boxes[t.tools[i]];
+			los[i] = fmax(tb.lo[k], t.box.lo[k]);
+			his[i] = fmin(tb.hi[k], t.box.hi[k]);
+			edges.push_back(los[i]);
+			edges.push_back(his[i]);
+		}
+		std::sort(los.begin(), los.end());
+		std::sort(his.begin(), his.end());
+		std::sort(edges.begin(), edges.end());
+		for (int j = 1; j < edges.size(); j++) {
+			if (edges[j] == edges[j-1]) continue;
+			const double at = (edges[j-1] + edges[j]) / 2;
+			if (at <= t.box.lo[k] || at >= t.box.hi[k]) continue;
+			const int below = std::lower_bound(los.begin(), los.end(), at) - los.begin();
+			const int above = his.end() - std::upper_bound(his.begin(), his.end(), at);
+			const int cost = std::max(below, above);
+			/* of equal planes, the one nearest the middle */
+			const double off = fabs(at - (t.box.lo[k] + t.box.hi[k]) / 2) / extent;
+			if (cost < best || (cost == best && best_axis >= 0 && off < best_off)) {
+				best = cost;
+				best_axis = k;
+				best_at = at;
+				best_off = off;
+			}
+		}
+	}
+	if (best_axis < 0) return false;
+
+	a.box = b.box = t.box;
+	a.box.hi[best_axis] = b.box.lo[best_axis] = best_at;
+	a.tools.clear();
+	b.tools.clear();
+	for (int i = 0; i < n; i++) {
+		const tile_box& tb = boxes[t.tools[i]];
+		if (tb.lo[best_axis] < best_at) a.tools.push_back(t.tools[i]);
+		if (tb.hi[best_axis] > best_at) b.tools.push_back(t.tools[i]);
+	}
+	return true;
+}
+
+/* a boolean on a tile thread: tiles share their inputs, so OCCT has to
+ * leave them as they are (it may otherwise widen tolerances in place).
+ * Cancels are checked once all tiles are in; false if it failed */
+template <class T> static bool run_shared_boolean(const TopoDS_Shape& a, const TopTools_ListOfShape& tools, TopoDS_Shape& out)
+{
+	T op;
+	op.SetNonDestructive(true);
+	build_boolean(op, a, tools, BOPAlgo_GlueOff);
+	if (op.HasErrors()) return false;
+	out = op.Shape();
+	return true;
+}
+
+/* true when shp lies flat (within tol) in one of the tile sides, given
+ * as axis and coordinate */
+static bool on_tile_side(const TopoDS_Shape& shp, double tol, const std::set<std::pair<int, double>>& planes)
+{
+	Bnd_Box bb;
+	BRepBndLib::Add(shp, bb, false);
+	if (bb.IsVoid()) return false;
+	const tile_box b = to_tile_box(bb);
+	tol = 2 * (tol + Precision::Confusion()); // the box is widened by the tolerance
+	for (auto it = planes.begin(); it != planes.end(); ++it) {
+		const int k = it->first;
+		if (b.hi[k] - b.lo[k] <= tol && fabs(0.5 * (b.lo[k] + b.hi[k]) - it->second) <= tol) return true;
+	}
+	return false;
+}
+
+static bool has_solid(const TopoDS_Shape& shp)
+{
+	return !shp.IsNull() && TopExp_Explorer(shp, TopAbs_SOLID).More();
+}
+
+/* run_boolean(), in tiles when it has more than --tile-booleans tools.
+ * A tile no tool touches keeps its slice of a in a cut and has nothing
+ * left in a common. If any tile (or the gluing) fails, the whole boolean
+ * is done again untiled rather than leave a hole where that tile was */
+template <class T> static TopoDS_Shape run_tiled_boolean(const TopoDS_Shape& a, const TopTools_ListOfShape& tools, bool is_cut)
+{
+	const int per_tile = atoi(run_tile_booleans);
+
+	/* patterns come in as compounds; each copy is a tool of its own */
+	std::vector<TopoDS_Shape> solids;
+	std::vector<tile_box> boxes;
+	for (TopTools_ListIteratorOfListOfShape it(tools); it.More(); it.Next()) {
+		std::vector<TopoDS_Shape> parts;
+		for (TopExp_Explorer ex(it.Value(), TopAbs_SOLID); ex.More(); ex.Next()) parts.push_back(ex.Current());
+		if (parts.empty()) parts.push_back(it.Value());
+		for (int i = 0; i < parts.size(); i++) {
+			Bnd_Box bb;
+			BRepBndLib::Add(parts[i], bb, false);
+			if (bb.IsVoid()) continue;
+			solids.push_back(parts[i]);
+			boxes.push_back(to_tile_box(bb));
+		}
+	}
+	if (per_tile < 1 || solids.size() <= per_tile || !has_solid(a)) return run_boolean<T>(a, tools);
+
+	boolean_tile root;
+	{
+		Bnd_Box bb;
+		BRepBndLib::Add(a, bb, false);
+		root.box = to_tile_box(bb);
+		/* some room, so no outer face of a lies on a tile side */
+		double pad = 0;
+		for (int k = 0; k < 3; k++) pad = fmax(pad, root.box.hi[k] - root.box.lo[k]);
+		pad = pad * 0.01 + 1e-6;
+		for (int k = 0; k < 3; k++) {
+			root.box.lo[k] -= pad;
+			root.box.hi[k] += pad;
+		}
+	}
+	for (int i = 0; i < solids.size(); i++) {
+		if (boxes_overlap(boxes[i], root.box)) root.tools.push_back(i);
+	}
+
+	std::vector<boolean_tile> tiles, todo(1, root);
+	while (!todo.empty()) {
+		boolean_tile t = todo.back();
+		todo.pop_back();
+		boolean_tile lo, hi;
+		if (t.tools.size() > per_tile && split_tile(t, boxes, lo, hi)) {
+			todo.push_back(hi);
+			todo.push_back(lo);
+		} else {
+			tiles.push_back(t);
+		}
+	}
+	if (tiles.size() == 1) return run_boolean<T>(a, tools);
+
+	const std::string what = str_printf("tiled boolean: %d tools in %d tiles", (int)solids.size(), (int)tiles.size());
+	scope_timer ST(what.c_str());
+
+	std::vector<TopoDS_Shape> pieces(tiles.size());
+	std::atomic<int> next(0), finished(0), failed(0);
+	/* progress is per thread; the calling thread reports for all */
+	auto work = [&](bool report) {
+		for (int i; (i = next++) < tiles.size() && !is_cancelled() && !failed; ) {
+			const boolean_tile& t = tiles[i];
+			if (is_cut || !t.tools.empty()) {
+				const tile_box& tb = t.box;
+				TopTools_ListOfShape box;
+				box.Append(BRepPrimAPI_MakeBox(gp_Pnt(tb.lo[0], tb.lo[1], tb.lo[2]), gp_Pnt(tb.hi[0], tb.hi[1], tb.hi[2])).Shape());
+				TopoDS_Shape slice;
+				bool ok = run_shared_boolean<BRepAlgoAPI_Common>(a, box, slice);
+				if (ok && !t.tools.empty() && has_solid(slice)) {
+					TopTools_ListOfShape ts;
+					for (int j = 0; j < t.tools.size(); j++) ts.Append(solids[t.tools[j]]);
+					ok = run_shared_boolean<T>(slice, ts, slice);
+				}
+				if (!ok) failed++;
+				pieces[i] = slice;
+			}
+			finished++;
+			if (report) report_progress(0.9 * finished / tiles.size());
+		}
+	};
+	const int max_jobs = std::min(job_limit(), (int)tiles.size());
+	std::vector<std::thread> threads;
+	for (int t = 1; t < max_jobs; t++) threads.push_back(std::thread(work, false));
+	work(true);
+	for (int t = 0; t < threads.size(); t++) threads[t].join();
+	check_cancel();
+	if (failed) {
+		printf("tiled boolean: a tile failed; redoing it untiled\n");
+		return run_boolean<T>(a, tools);
+	}
+
+	/* neighbouring pieces share their sides exactly */
+	TopoDS_Shape r;
+	TopTools_ListOfShape rest;
+	for (int i = 0; i < pieces.size(); i++) {
+		if (!has_solid(pieces[i])) continue;
+		if (r.IsNull()) {
+			r = pieces[i];
+		} else {
+			rest.Append(pieces[i]);
+		}
+	}
+	if (r.IsNull()) {
+		TopoDS_Compound empty;
+		BRep_Builder b;
+		b.MakeCompound(empty);
+		return empty;
+	}
+	if (!rest.IsEmpty()) {
+		BRepAlgoAPI_Fuse glue;
+		build_boolean(glue, r, rest, BOPAlgo_GlueShift);
+		check_cancel();
+		if (glue.HasErrors()) {
+			printf("tiled boolean: gluing the tiles failed; redoing it untiled\n");
+			return run_boolean<T>(a, tools);
+		}
+		r = glue.Shape();
+	}
+
+	/* the tile sides split faces of a; merge those again, but only
+	 * across the sides, so the rest comes out as run_boolean() has it */
+	std::set<std::pair<int, double>> planes;
+	for (int i = 0; i < tiles.size(); i++) {
+		for (int k = 0; k < 3; k++) {
+			if (tiles[i].box.lo[k] != root.box.lo[k]) planes.insert(std::make_pair(k, tiles[i].box.lo[k]));
+			if (tiles[i].box.hi[k] != root.box.hi[k]) planes.insert(std::make_pair(k, tiles[i].box.hi[k]));
+		}
+	}
+	TopTools_MapOfShape keep;
+	for (TopExp_Explorer it(r, TopAbs_EDGE); it.More(); it.Next()) {
+		const TopoDS_Edge& edge = TopoDS::Edge(it.Current());
+		if (!on_tile_side(edge, BRep_Tool::Tolerance(edge), planes)) keep.Add(edge);
+	}
+	for (TopExp_Explorer it(r, TopAbs_VERTEX); it.More(); it.Next()) {
+		const TopoDS_Vertex& vertex = TopoDS::Vertex(it.Current());
+		if (!on_tile_side(vertex, BRep_Tool::Tolerance(vertex), planes)) keep.Add(vertex);
+	}
+	return unify_same_domain(r, &keep);
+}
+
+/* world-space transforms of the extra copies made by each mirror(),
+ * symmetric() and pattern_*() being recorded; markers and cull volumes
+ * inside their bodies are replicated with them */
+std::vector<std::vector<gp_Trsf>> replicate_stack;
+
+/* node tree IR (--write-ir, --write-ir-text, load_ir()): the recorded
+ * program as a stream of objects, markers and cull volumes in the order
+ * they were made. The binary form is little-endian; the text form has
+ * one node per line and is meant for diffing */
+#define IR_MAGIC "CGIR"
+#define IR_TEXT_MAGIC "cgir"
+#define IR_VERSION 1
+
+enum ir_event {
+	IR_OBJECT = 1,
+	IR_MARKER,
+	IR_CULL,
+};
+
+struct ir_writer {
+	bool text;
+	int depth;
+	std::string out;
+
+	ir_writer(bool text) : text(text), depth(0) {}
+
+	/* what we write was checked when it was made */
+	void check(bool ok, const char* what) { assert(ok); }
+
+	void header()
+	{
+		if (text) {
+			out += str_printf("%s %d\n", IR_TEXT_MAGIC, IR_VERSION);
+		} else {
+			out += IR_MAGIC;
+			u32(IR_VERSION);
+		}
+	}
+
+	void u8(uint8_t v) { out.push_back((char)v); }
+	void u32(uint32_t v) { for (int i = 0; i < 4; i++) u8((v >> (i*8)) & 0xff); }
+
+	/* starts a line (text) or an event/node tag (binary) */
+	void begin(const char* name, int tag)
+	{
+		if (text) {
+			for (int i = 0; i < depth; i++) out += "\t";
+			out += name;
+		} else {
+			u8(tag);
+		}
+	}
+
+	void count(int n)
+	{
+		if (text) {
+			out += str_printf(" %d", n);
+		} else {
+			u32(n);
+		}
+	}
+
+	void integer(const int& v)
+	{
+		count(v);
+	}
+
+	void num(const double& v)
+	{
+		if (text) {
+			out += str_printf(" %.17g", v);
+		} else {
+			uint64_t bits;
+			memcpy(&bits, &v, sizeof bits);
+			for (int i = 0; i < 8; i++) u8((bits >> (i*8)) & 0xff);
+		}
+	}
+
+	void flag(const bool& v)
+	{
+		if (text) {
+			out += v ? " 1" : " 0";
+		} else {
+			u8(v);
+		}
+	}
+
+	void vec(const v3& v)
+	{
+		for (int i = 0; i < 3; i++) num(v.s[i]);
+	}
+
+	void str(const char* const& s)
+	{
+		if (text) {
+			if (s == NULL) {
+				out += " -";
+				return;
+			}
+			out += " \"";
+			for (const char* c = s; *c; c++) {
+				if (*c == '"' || *c == '\\') out += '\\';
+				if (*c == '\n') {
+					out += "\\n";
+				} else {
+					out += *c;
+				}
+			}
+			out += "\"";
+		} else if (s == NULL) {
+			u32(0xffffffff);
+		} else {
+			const uint32_t n = strlen(s);
+			u32(n);
+			out.append(s, n);
+		}
+	}
+
+	void trsf(const gp_Trsf& tx)
+	{
+		for (int row = 1; row <= 3; row++) {
+			for (int col = 1; col <= 4; col++) num(tx.Value(row, col));
+		}
+	}
+
+	void begin_children()
+	{
+		if (text) {
+			out += " {\n";
+			depth++;
+		}
+	}
+
+	void end_children()
+	{
+		if (text) {
+			depth--;
+			for (int i = 0; i < depth; i++) out += "\t";
+			out += "}\n";
+		} else {
+			u8(0);
+		}
+	}
+
+	void end_line()
+	{
+		if (text) out += "\n";
+	}
+};
+
+ir_writer ir_bin(false), ir_text(true);
+
+static bool is_writing_ir()
+{
+	return run_write_ir || run_write_ir_text;
+}
+
+static uint64_t fnv1a64(const std::string& data)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < data.size(); i++) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* strings read from IR live as long as the program, like the literals
+ * they stand in for; equal strings share one pointer */
+static const char* intern(const std::string& s)
+{
+	static std::set<std::string> strings;
+	return strings.insert(s).first->c_str();
+}
+
+struct ir_reader {
+	const char* path;
+	std::string data;
+	size_t pos;
+	bool text;
+
+	ir_reader(const char* path) : path(path), pos(0), text(false)
+	{
+		FILE* f = fopen(path, "rb");
+		if (f == NULL) {
+			fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		char buf[65536];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof buf, f)) > 0) data.append(buf, n);
+		fclose(f);
+
+		int version;
+		if (data.compare(0, 4, IR_MAGIC) == 0) {
+			pos = 4;
+			version = u32();
+		} else if (data.compare(0, 4, IR_TEXT_MAGIC) == 0) {
+			text = true;
+			pos = 4;
+			version = atoi(token().c_str());
+		} else {
+			fail("not a cg IR file");
+		}
+		if (version != IR_VERSION) fail("unsupported IR version");
+	}
+
+	void fail(const char* what)
+	{
+		fprintf(stderr, "%s: %s (at byte %zu)\n", path, what, pos);
+		exit(EXIT_FAILURE);
+	}
+
+	/* for values the node relies on, e.g. array sizes */
+	void check(bool ok, const char* what)
+	{
+		if (!ok) fail(what);
+	}
+
+	void skip_space()
+	{
+		while (pos < data.size()) {
+			if (data[pos] == '#') {
+				while (pos < data.size() && data[pos] != '\n') pos++;
+			} else if (isspace((unsigned char)data[pos])) {
+				pos++;
+			} else {
+				break;
+			}
+		}
+	}
+
+	bool at_end()
+	{
+		if (text) skip_space();
+		return pos >= data.size();
+	}
+
+	/* next text token; quoted strings are returned unescaped with
+	 * *quoted set */
+	std::string token(bool* quoted = NULL)
+	{
+		skip_space();
+		if (pos >= data.size()) fail("unexpected end of file");
+		std::string t;
+		if (quoted) *quoted = false;
+		if (data[pos] == '"') {
+			if (quoted) *quoted = true;
+			pos++;
+			while (pos < data.size() && data[pos] != '"') {
+				if (data[pos] == '\\' && pos+1 < data.size()) {
+					pos++;
+					t += data[pos] == 'n' ? '\n' : data[pos];
+				} else {
+					t += data[pos];
+				}
+				pos++;
+			}
+			if (pos >= data.size()) fail("unterminated string");
+			pos++;
+		} else if (data[pos] == '{' || data[pos] == '}') {
+			t = data[pos++];
+		} else {
+			while (pos < data.size() && !isspace((unsigned char)data[pos]) && data[pos] != '{' && data[pos] != '}') {
+				t += data[pos++];
+			}
+		}
+		return t;
+	}
+
+	uint8_t u8()
+	{
+		if (pos >= data.size()) fail("unexpected end of file");
+		return data[pos++];
+	}
+
+	uint32_t u32()
+	{
+		uint32_t v = 0;
+		for (int i = 0; i < 4; i++) v |= (uint32_t)u8() << (i*8);
+		return v;
+	}
+
+	/* reads an event/node tag; text names are looked up by name_of */
+	template <class F> int begin(F name_of)
+	{
+		if (!text) return u8();
+		std::string t = token();
+		for (int tag = 1; name_of(tag) != NULL; tag++) {
+			if (t == name_of(tag)) return tag;
+		}
+		fail(str_printf("unexpected \"%s\"", t.c_str()).c_str());
+		return 0;
+	}
+
+	int count()
+	{
+		if (text) return atoi(token().c_str());
+		return u32();
+	}
+
+	void integer(int& v)
+	{
+		v = count();
+	}
+
+	void num(double& v)
+	{
+		if (text) {
+			std::string t = token();
+			char* end;
+			v = strtod(t.c_str(), &end);
+			if (end == t.c_str() || *end) fail("expected a number");
+		} else {
+			uint64_t bits = 0;
+			for (int i = 0; i < 8; i++) bits |= (uint64_t)u8() << (i*8);
+			memcpy(&v, &bits, sizeof v);
+		}
+	}
+
+	void flag(bool& v)
+	{
+		if (text) {
+			v = atoi(token().c_str()) != 0;
+		} else {
+			v = u8() != 0;
+		}
+	}
+
+	void vec(v3& v)
+	{
+		for (int i = 0; i < 3; i++) num(v.s[i]);
+	}
+
+	void str(const char*& s)
+	{
+		if (text) {
+			bool quoted;
+			std::string t = token(&quoted);
+			if (!quoted && t == "-") {
+				s = NULL;
+			} else if (!quoted) {
+				fail("expected a string");
+			} else {
+				s = intern(t);
+			}
+		} else {
+			uint32_t n = u32();
+			if (n == 0xffffffff) {
+				s = NULL;
+			} else {
+				if (pos + n > data.size()) fail("unexpected end of file");
+				s = intern(data.substr(pos, n));
+				pos += n;
+			}
+		}
+	}
+
+	gp_Trsf trsf()
+	{
+		double m[12];
+		for (int i = 0; i < 12; i++) num(m[i]);
+		gp_Trsf tx;
+		tx.SetValues(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8], m[9], m[10], m[11]);
+		return tx;
+	}
+
+	void begin_children()
+	{
+		if (text && token() != "{") fail("expected {");
+	}
+
+	/* true while there are children left; consumes the end marker */
+	bool more_children()
+	{
+		if (text) {
+			skip_space();
+			if (pos < data.size() && data[pos] == '}') {
+				pos++;
+				return false;
+			}
+			return true;
+		}
+		if (pos < data.size() && data[pos] == 0) {
+			pos++;
+			return false;
+		}
+		return true;
+	}
+};
+
+static const char* ir_event_name(int event)
+{
+	switch (event) {
+	case IR_OBJECT: return "mkobj";
+	case IR_MARKER: return "marker";
+	case IR_CULL: return "cull";
+	}
+	return NULL;
+}
+
+/* appends to whichever IR outputs are enabled */
+template <class F> static void record_ir(F f)
+{
+	if (run_write_ir) f(ir_bin);
+	if (run_write_ir_text) f(ir_text);
+}
+
+/* --face-cache <dir>: face triangulations keyed by a hash of the bare
+ * face (BRepTools' dump of its surface, edges and tolerances, without
+ * location, orientation or mesh) and the deflections, so unchanged faces
+ * are not re-meshed. Hits come from memory within a run and from
+ * <dir>/<key>.tri across runs. Only touched by the thread meshing */
+#define FACE_CACHE_MAGIC "CGFT"
+#define FACE_CACHE_VERSION 1
+
+std::map<uint64_t, Handle(Poly_Triangulation)> face_cache;
+
+struct face_cache_stats {
+	int hits, disk_hits, misses;
+	face_cache_stats() : hits(0), disk_hits(0), misses(0) {}
+};
+
+static uint64_t face_cache_key(const TopoDS_Face& fac, double linear_deflection, bool is_relative, double angular_deflection)
+{
+	TopoDS_Shape bare = fac.Oriented(TopAbs_FORWARD).Located(TopLoc_Location());
+	TopLoc_Location location;
+	if (!BRep_Tool::Triangulation(fac, location).IsNull()) {
+		/* an old mesh would be part of the dump */
+		bare = BRepBuilderAPI_Copy(bare, Standard_True, Standard_False).Shape();
+	}
+	std::ostringstream os;
+	BRepTools::Write(bare, os);
+	os << str_printf("\n%d %.17g %d %.17g\n", FACE_CACHE_VERSION, linear_deflection, is_relative, angular_deflection);
+	return fnv1a64(os.str());
+}
+
+static std::string face_cache_path(uint64_t key)
+{
+	return str_printf("%s/%016llx.tri", run_face_cache, (unsigned long long)key);
+}
+
+/* nodes and triangles as written by store_cached_face(), in native byte
+ * order; anything unexpected is a miss */
+static Handle(Poly_Triangulation) read_cached_face(uint64_t key)
+{
+	FILE* f = fopen(face_cache_path(key).c_str(), "rb");
+	if (f == NULL) return Handle(Poly_Triangulation)();
+	Handle(Poly_Triangulation) pt;
+	char magic[4];
+	int32_t header[3];
+	double deflection;
+	if (fread(magic, 4, 1, f) == 1 && memcmp(magic, FACE_CACHE_MAGIC, 4) == 0
+	&& fread(header, sizeof header, 1, f) == 1 && header[0] == FACE_CACHE_VERSION && header[1] > 0 && header[2] > 0
+	&& fread(&deflection, sizeof deflection, 1, f) == 1) {
+		const int n_nodes = header[1], n_tris = header[2];
+		std::vector<double> xyz(n_nodes*3);
+		std::vector<int32_t> idx(n_tris*3);
+		if (fread(xyz.data(), sizeof(double), xyz.size(), f) == xyz.size()
+		&& fread(idx.data(), sizeof(int32_t), idx.size(), f) == idx.size()) {
+			TColgp_Array1OfPnt nodes(1, n_nodes);
+			for (int i = 0; i < n_nodes; i++) nodes.SetValue(i+1, gp_Pnt(xyz[i*3], xyz[i*3+1], xyz[i*3+2]));
+			Poly_Array1OfTriangle triangles(1, n_tris);
+			bool ok = true;
+			for (int i = 0; i < idx.size(); i++) ok = ok && idx[i] >= 1 && idx[i] <= n_nodes;
+			for (int i = 0; i < n_tris; i++) triangles.SetValue(i+1, Poly_Triangle(idx[i*3], idx[i*3+1], idx[i*3+2]));
+			if (ok) {
+				pt = new Poly_Triangulation(nodes, triangles);
+				pt->Deflection(deflection);
+			}
+		}
+	}
+	fclose(f);
+	return pt;
+}
+
+/* written to a temporary name and renamed, so concurrent --isolate
+ * workers never see half a file */
+static void store_cached_face(uint64_t key, const Handle(Poly_Triangulation)& pt)
+{
+	if (!run_low_memory) face_cache[key] = pt;
+
+	const std::string path = face_cache_path(key);
+	const std::string tmp = path + str_printf(".%d", (int)getpid());
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (f == NULL) return;
+	const TColgp_Array1OfPnt& nodes = pt->Nodes();
+	const Poly_Array1OfTriangle& triangles = pt->Triangles();
+	int32_t header[3] = { FACE_CACHE_VERSION, nodes.Length(), triangles.Length() };
+	double deflection = pt->Deflection();
+	std::vector<double> xyz;
+	for (int i = nodes.Lower(); i <= nodes.Upper(); i++) {
+		const gp_Pnt& p = nodes(i);
+		xyz.push_back(p.X());
+		xyz.push_back(p.Y());
+		xyz.push_back(p.Z());
+	}
+	std::vector<int32_t> idx;
+	for (int i = triangles.Lower(); i <= triangles.Upper(); i++) {
+		Standard_Integer n0, n1, n2;
+		triangles(i).Get(n0, n1, n2);
+		idx.push_back(n0);
+		idx.push_back(n1);
+		idx.push_back(n2);
+	}
+	bool ok = fwrite(FACE_CACHE_MAGIC, 4, 1, f) == 1
+		&& fwrite(header, sizeof header, 1, f) == 1
+		&& fwrite(&deflection, sizeof deflection, 1, f) == 1
+		&& fwrite(xyz.data(), sizeof(double), xyz.size(), f) == xyz.size()
+		&& fwrite(idx.data(), sizeof(int32_t), idx.size(), f) == idx.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) unlink(tmp.c_str());
+}
+
+static Handle(Poly_Triangulation) find_cached_face(uint64_t key, face_cache_stats& stats)
+{
+	auto it = face_cache.find(key);
+	if (it != face_cache.end()) {
+		stats.hits++;
+		return it->second;
+	}
+	Handle(Poly_Triangulation) pt = read_cached_face(key);
+	if (!pt.IsNull()) {
+		stats.hits++;
+		stats.disk_hits++;
+		if (!run_low_memory) face_cache[key] = pt;
+	}
+	return pt;
+}
+
+/* --mesh-cache <dir>: each object's build_mesh() output, keyed by
+ * mesh_cache_key(), in <dir>/<key>.mesh. A hit skips building the shape
+ * and meshing; the file is mapped and the exporters read its arrays in
+ * place. The layout is the header and then the vertex, normal and
+ * triangle arrays as they are in memory (native byte order) */
+#define MESH_CACHE_MAGIC "CGMC"
+#define MESH_CACHE_VERSION 1
+
+struct mesh_cache_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t n_vertices, n_normals, n_triangles, reserved;
+};
+
+static_assert(sizeof(v3) == 3*sizeof(double), "v3 is stored as 3 doubles");
+static_assert(sizeof(mesh_cache_header) % sizeof(double) == 0, "arrays after the header stay aligned");
+
+struct mapped_mesh {
+	void* addr;
+	size_t size;
+	mesh_view view;
+};
+
+static std::string mesh_cache_path(uint64_t key)
+{
+	return str_printf("%s/%016llx.mesh", run_mesh_cache, (unsigned long long)key);
+}
+
+/* NULL on a miss, or if the file is not one we wrote for this key */
+static mapped_mesh* map_cached_mesh(uint64_t key)
+{
+	int fd = open(mesh_cache_path(key).c_str(), O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	void* addr = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= sizeof(mesh_cache_header)) {
+		addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (addr == MAP_FAILED) return NULL;
+
+	const mesh_cache_header* h = (const mesh_cache_header*)addr;
+	const char* p = (const char*)(h+1);
+	mesh_view v;
+	v.n_vertices = h->n_vertices;
+	v.n_normals = h->n_normals;
+	v.n_triangles = h->n_triangles;
+	v.vertices = (const v3*)p;
+	v.normals = v.vertices + v.n_vertices;
+	v.triangles = (const triangle*)(v.normals + v.n_normals);
+	bool ok = memcmp(h->magic, MESH_CACHE_MAGIC, 4) == 0
+		&& h->version == MESH_CACHE_VERSION
+		&& h->key == key
+		&& (size_t)st.st_size == sizeof *h + ((size_t)v.n_vertices + v.n_normals) * sizeof(v3) + (size_t)v.n_triangles * sizeof(triangle);
+	for (int i = 0; ok && i < v.n_triangles; i++) {
+		const triangle& t = v.triangles[i];
+		ok = t.v0 >= 0 && t.v0 < v.n_vertices && t.v1 >= 0 && t.v1 < v.n_vertices
+			&& t.v2 >= 0 && t.v2 < v.n_vertices && t.n >= 0 && t.n < v.n_normals;
+	}
+	if (!ok) {
+		munmap(addr, st.st_size);
+		return NULL;
+	}
+
+	mapped_mesh* mm = new mapped_mesh;
+	mm->addr = addr;
+	mm->size = st.st_size;
+	mm->view = v;
+	return mm;
+}
+
+static void unmap_cached_mesh(mapped_mesh* mm)
+{
+	munmap(mm->addr, mm->size);
+	delete mm;
+}
+
+/* written to a temporary name and renamed, like store_cached_face() */
+static void store_cached_mesh(uint64_t key, const mesh* m)
+{
+	mesh_cache_header h;
+	memcpy(h.magic, MESH_CACHE_MAGIC, 4);
+	h.version = MESH_CACHE_VERSION;
+	h.key = key;
+	h.n_vertices = m->vertices.size();
+	h.n_normals = m->normals.size();
+	h.n_triangles = m->triangles.size();
+	h.reserved = 0;
+
+	const std::string path = mesh_cache_path(key);
+	const std::string tmp = path + str_printf(".%d", (int)getpid());
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (f == NULL) return;
+	bool ok = fwrite(&h, sizeof h, 1, f) == 1
+		&& fwrite(m->vertices.data(), sizeof(v3), m->vertices.size(), f) == m->vertices.size()
+		&& fwrite(m->normals.data(), sizeof(v3), m->normals.size(), f) == m->normals.size()
+		&& fwrite(m->triangles.data(), sizeof(triangle), m->triangles.size(), f) == m->triangles.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) unlink(tmp.c_str());
+}
+
+static mesh* copy_mesh(const mesh_view& v)
+{
+	mesh* m = new mesh;
+	m->vertices.assign(v.vertices, v.vertices + v.n_vertices);
+	m->normals.assign(v.normals, v.normals + v.n_normals);
+	m->triangles.assign(v.triangles, v.triangles + v.n_triangles);
+	return m;
+}
+
+/* an object handed to the --pipeline writer thread: its shape plus a
+ * snapshot of the per-object state build_mesh() reads */
+struct mesh_job {
+	node* root;
+	TopoDS_Shape shp;
+	std::vector<analytic_part> analytic_parts;
+	std::map<const Geom_Surface*, tagged_surface> surface_resolutions;
+	std::vector<cull_volume> cull_volumes;
+};
+
+static void run_mesh_job(mesh_job* job);
+
+/* with --pipeline, meshing and writing run on one background thread, in
+ * order, while the next object builds. The queue is bounded so building
+ * can't run arbitrarily far ahead of writing and pile up shapes */
+#define PIPELINE_DEPTH 2
+struct pipeline {
+	std::thread* thread;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<mesh_job*> jobs;
+	bool busy;
+	bool parked;
+
+	pipeline() : thread(NULL), busy(false), parked(false) {}
+
+	void push(mesh_job* job)
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		if (thread == NULL) thread = new std::thread([this] { run(); });
+		cv.wait(lk, [this] { return jobs.size() < PIPELINE_DEPTH || parked; });
+		if (parked) {
+			lk.unlock();
+			check_cancel();
+		}
+		jobs.push_back(job);
+		cv.notify_all();
+	}
+
+	/* waits until every queued object is written */
+	void drain()
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		cv.wait(lk, [this] { return (jobs.empty() && !busy) || parked; });
+		if (parked) {
+			lk.unlock();
+			check_cancel();
+		}
+	}
+
+	/* on cancel the writer thread waits here for good, and the main
+	 * thread (woken if it is waiting on the writer) exits and reports;
+	 * exit() must not run while the main thread is still building */
+	void park()
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		parked = true;
+		cv.notify_all();
+		cv.wait(lk, [] { return false; });
+	}
+
+	void run()
+	{
+		on_writer_thread = true;
+		std::unique_lock<std::mutex> lk(mtx);
+		for (;;) {
+			cv.wait(lk, [this] { return !jobs.empty(); });
+			mesh_job* job = jobs.front();
+			jobs.pop_front();
+			busy = true;
+			cv.notify_all();
+			lk.unlock();
+			run_mesh_job(job);
+			lk.lock();
+			busy = false;
+			cv.notify_all();
+		}
+	}
+};
+/* never destroyed: at exit() the writer thread is still waiting on the
+ * condition variable, and destroying it (or a joinable thread) then
+ * hangs or aborts */
+pipeline& writer_pipeline = *new pipeline;
+
+static void park_writer_thread()
+{
+	writer_pipeline.park();
+}
+
+struct node {
+	enum node_type type;
+	std::vector<node*> children;
+
+	union {
+		struct {
+			const char* name;
+			const char* instance_marker;
+			double linear_deflection;
+			bool is_relative;
+			double angular_deflection;
+		} mkobj;
+
+		struct {
+			v3 v;
+		} translate;
+
+		struct {
+			double degrees;
+			v3 axis;
+		} rotate;
+
+		struct {
+			double radius;
+		} fillet;
+
+		struct {
+			double linear_deflection;
+			double angular_deflection;
+		} resolution;
+
+		struct {
+			double thickness;
+			int n_open;
+			v3 open[6];
+		} shell;
+
+		struct {
+			double distance;
+		} offset;
+
+		struct {
+			v3 size;
+		} box;
+
+		struct {
+			v3 size;
+			double ltx;
+		} wedge;
+
+		struct {
+			double radius;
+		} sphere;
+
+		struct {
+			double radius, height;
+		} cylinder;
+
+		struct {
+			double r0, r1, height;
+		} cone;
+
+		struct {
+			v3 v;
+		} prism;
+
+		struct {
+			v3 axis;
+			double degrees;
+		} revolve;
+
+		struct {
+			const char* path;
+		} import_brep;
+
+		struct {
+			v3 n;
+		} mirror;
+
+		struct {
+			int n;
+			v3 axis;
+		} symmetric;
+
+		struct {
+			int count;
+			v3 step;
+		} pattern_linear;
+
+		struct {
+			int count;
+			v3 axis;
+			double degrees;
+		} pattern_polar;
+
+		struct {
+			v3 p;
+		} move_to;
+
+		struct {
+			v3 p;
+		} line_to;
+
+		struct {
+			v3 via, p;
+		} circle_arc_to;
+
+		struct {
+			v3 center;
+			double radius;
+			v3 normal;
+		} circle;
+	};
+
+	node(enum node_type type) : type(type) {}
+
+	~node()
+	{
+		for (int i = 0; i < children.size(); i++) delete children[i];
+	}
+
+	bool is_leaf() {
+		switch (type) {
+		case MKOBJ:
+		case GROUP:
+		case TRANSLATE:
+		case ROTATE:
+		case CUT:
+		case COMMON:
+		case FUSE:
+		case FILLET:
+		case RESOLUTION:
+		case SHELL:
+		case OFFSET:
+		case PRISM:
+		case REVOLVE:
+		case FACE:
+		case MIRROR:
+		case SYMMETRIC:
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR:
+			return false;
+		case BOX:
+		case WEDGE:
+		case SPHERE:
+		case CYLINDER:
+		case CONE:
+		case IMPORT_BREP:
+		case MOVE_TO:
+		case LINE_TO:
+		case CIRCLE_ARC_TO:
+		case CIRCLE:
+			return true;
+		}
+		assert(!"unhandled type");
+	}
+
+	std::string label()
+	{
+		switch (type) {
+		case MKOBJ: return str_printf("mkobj(\"%s\")", mkobj.name);
+		case GROUP: return str_printf("group");
+		case TRANSLATE: return str_printf("translate(%f,%f,%f)", translate.v.x, translate.v.y, translate.v.z);
+		case ROTATE: return str_printf("rotate(degrees=%f, axis={%f,%f,%f})", rotate.degrees, rotate.axis.x, rotate.axis.y, rotate.axis.z);
+		case CUT: return str_printf("cut");
+		case COMMON: return str_printf("common");
+		case FUSE: return str_printf("fuse");
+		case FILLET: return str_printf("fillet(radius=%f)", fillet.radius);
+		case SHELL: {
+			std::string r = str_printf("shell(thickness=%f", shell.thickness);
+			for (int i = 0; i < shell.n_open; i++) r += str_printf(", open={%f,%f,%f}", shell.open[i].x, shell.open[i].y, shell.open[i].z);
+			return r + ")";
+		}
+		case OFFSET: return str_printf("offset(distance=%f)", offset.distance);
+		case RESOLUTION: return str_printf("resolution(linear=%f, angular=%f)", resolution.linear_deflection, resolution.angular_deflection);
+		case PRISM: return str_printf("prism(v={%f,%f,%f})", prism.v.x, prism.v.y, prism.v.z);
+		case REVOLVE: return str_printf("revolve(axis={%f,%f,%f}, degrees=%f)", revolve.axis.x, revolve.axis.y, revolve.axis.z, revolve.degrees);
+		case MIRROR: return str_printf("mirror(n={%f,%f,%f})", mirror.n.x, mirror.n.y, mirror.n.z);
+		case SYMMETRIC: return str_printf("symmetric(n=%d, axis={%f,%f,%f})", symmetric.n, symmetric.axis.x, symmetric.axis.y, symmetric.axis.z);
+		case PATTERN_LINEAR: return str_printf("pattern_linear(count=%d, step={%f,%f,%f})", pattern_linear.count, pattern_linear.step.x, pattern_linear.step.y, pattern_linear.step.z);
+		case PATTERN_POLAR: return str_printf("pattern_polar(count=%d, axis={%f,%f,%f}, degrees=%f)", pattern_polar.count, pattern_polar.axis.x, pattern_polar.axis.y, pattern_polar.axis.z, pattern_polar.degrees);
+		case FACE: return str_printf("face");
+		case BOX: return str_printf("box(%f,%f,%f)", box.size.x, box.size.y, box.size.z);
+		case WEDGE: return str_printf("wedge(%f,%f,%f,%f)", wedge.size.x, wedge.size.y, wedge.size.z, wedge.ltx);
+		case SPHERE: return str_printf("sphere(%f)", sphere.radius);
+		case CYLINDER: return str_printf("cylinder(r=%f,h=%f)", cylinder.radius, cylinder.height);
+		case CONE: return str_printf("cone(r0=%f,r1=%f,h=%f)", cone.r0, cone.r1, cone.height);
+		case IMPORT_BREP: return str_printf("import_brep(\"%s\")", import_brep.path);
+		case MOVE_TO: return str_printf("move_to(p={%f,%f,%f})", move_to.p.x, move_to.p.y, move_to.p.z);
+		case LINE_TO: return str_printf("line_to(p={%f,%f,%f})", line_to.p.x, line_to.p.y, line_to.p.z);
+		case CIRCLE_ARC_TO: return str_printf("circle_arc_to(via={%f,%f,%f} p={%f,%f,%f})", circle_arc_to.via.x, circle_arc_to.via.y, circle_arc_to.via.z, circle_arc_to.p.x, circle_arc_to.p.y, circle_arc_to.p.z);
+		case CIRCLE: return str_printf("circle(center={%f,%f,%f} r=%f normal={%f,%f,%f})", circle.center.x, circle.center.y, circle.center.z, circle.radius, circle.normal.x, circle.normal.y, circle.normal.z);
+		}
+		assert(!"unhandled type");
+	}
+
+	void dump_label()
+	{
+		fputs(label().c_str(), stdout);
+	}
+
+	void dump_rec(int depth = 0)
+	{
+		auto tab = [](int depth){ for (int i = 0; i < depth; i++) printf("   "); };
+		tab(depth);
+
+		dump_label();
+
+		if (is_leaf()) {
+			printf(";\n");
+		} else {
+			printf(" {\n");
+			for (auto it = children.begin(); it != children.end(); it++) {
+				(*it)->dump_rec(depth+1);
+			}
+			tab(depth); printf("}\n");
+		}
+	}
+
+	/* the node parameters, in IR order; IO is ir_writer or ir_reader */
+	template <class IO> void ir_fields(IO& io)
+	{
+		switch (type) {
+		case MKOBJ:
+			io.str(mkobj.name);
+			io.str(mkobj.instance_marker);
+			io.num(mkobj.linear_deflection);
+			io.flag(mkobj.is_relative);
+			io.num(mkobj.angular_deflection);
+			break;
+		case TRANSLATE: io.vec(translate.v); break;
+		case ROTATE: io.num(rotate.degrees); io.vec(rotate.axis); break;
+		case FILLET: io.num(fillet.radius); break;
+		case SHELL:
+			io.num(shell.thickness);
+			io.integer(shell.n_open);
+			io.check(shell.n_open >= 0 && shell.n_open <= 6, "invalid shell");
+			for (int i = 0; i < shell.n_open; i++) io.vec(shell.open[i]);
+			break;
+		case OFFSET: io.num(offset.distance); break;
+		case RESOLUTION: io.num(resolution.linear_deflection); io.num(resolution.angular_deflection); break;
+		case PRISM: io.vec(prism.v); break;
+		case REVOLVE: io.vec(revolve.axis); io.num(revolve.degrees); break;
+		case BOX: io.vec(box.size); break;
+		case WEDGE: io.vec(wedge.size); io.num(wedge.ltx); break;
+		case SPHERE: io.num(sphere.radius); break;
+		case CYLINDER: io.num(cylinder.radius); io.num(cylinder.height); break;
+		case CONE: io.num(cone.r0); io.num(cone.r1); io.num(cone.height); break;
+		case IMPORT_BREP: io.str(import_brep.path); break;
+		case MOVE_TO: io.vec(move_to.p); break;
+		case LINE_TO: io.vec(line_to.p); break;
+		case CIRCLE_ARC_TO: io.vec(circle_arc_to.via); io.vec(circle_arc_to.p); break;
+		case CIRCLE: io.vec(circle.center); io.num(circle.radius); io.vec(circle.normal); break;
+		case MIRROR: io.vec(mirror.n); break;
+		case SYMMETRIC: io.integer(symmetric.n); io.vec(symmetric.axis); break;
+		case PATTERN_LINEAR: io.integer(pattern_linear.count); io.vec(pattern_linear.step); break;
+		case PATTERN_POLAR: io.integer(pattern_polar.count); io.vec(pattern_polar.axis); io.num(pattern_polar.degrees); break;
+		case GROUP:
+		case CUT:
+		case COMMON:
+		case FUSE:
+		case FACE:
+			break;
+		}
+	}
+
+	void write_ir(ir_writer& w)
+	{
+		w.begin(node_type_name(type), type);
+		ir_fields(w);
+		if (is_leaf()) {
+			w.end_line();
+			return;
+		}
+		w.begin_children();
+		for (int i = 0; i < children.size(); i++) children[i]->write_ir(w);
+		w.end_children();
+	}
+
+	static node* read_ir(ir_reader& r, int type)
+	{
+		if (node_type_name(type) == NULL) r.fail("invalid node type");
+		node* n = new node((enum node_type)type);
+		n->ir_fields(r);
+		if (!n->is_leaf()) {
+			r.begin_children();
+			while (r.more_children()) n->children.push_back(read_ir(r, r.begin(node_type_name)));
+		}
+		return n;
+	}
+
+	/* identifies the subtree; equal hashes mean equal trees */
+	uint64_t ir_hash()
+	{
+		ir_writer w(false);
+		write_ir(w);
+		return fnv1a64(w.out);
+	}
+
+	bool uses_import()
+	{
+		if (type == IMPORT_BREP) return true;
+		for (int i = 0; i < children.size(); i++) {
+			if (children[i]->uses_import()) return true;
+		}
+		return false;
+	}
+
+	/* appends what identifies the files import_brep() reads */
+	void write_import_ids(ir_writer& w)
+	{
+		if (type == IMPORT_BREP) {
+			struct stat st;
+			if (stat(import_brep.path, &st) == 0) {
+				w.integer(st.st_size);
+				w.integer(st.st_mtime);
+			}
+		}
+		for (int i = 0; i < children.size(); i++) children[i]->write_import_ids(w);
+	}
+
+	/* everything build_mesh() output depends on: the tree (deflections
+	 * included), the files it imports, the cull volumes, --unify*,
+	 * --tile-booleans and --isolate (a worker that fails or runs out of
+	 * --budget leaves its subtree empty) */
+	uint64_t mesh_cache_key()
+	{
+		ir_writer w(false);
+		w.integer(MESH_CACHE_VERSION);
+		write_ir(w);
+		write_import_ids(w);
+		for (int i = 0; i < cull_volumes.size(); i++) {
+			const cull_volume& vol = cull_volumes[i];
+			for (int j = 0; j < vol.planes.size(); j++) {
+				w.vec(vol.planes[j].p);
+				w.vec(vol.planes[j].n);
+			}
+			w.end_line();
+		}
+		w.flag(run_unify);
+		w.flag(run_unify_booleans);
+		if (run_tile_booleans) w.integer(atoi(run_tile_booleans));
+		if (run_isolate) w.flag(run_isolate);
+		return fnv1a64(w.out);
+	}
+
+	TopoDS_Shape build_group_shape(int offset = 0)
+	{
+		TopoDS_Compound shp;
+		BRep_Builder b;
+		b.MakeCompound(shp);
+		for (int i = offset; i < children.size(); i++) {
+			b.Add(shp, children[i]->build_shape_rec());
+		}
+		return shp;
+	}
+
+	/* translate() and rotate() are rigid, so the body is placed by
+	 * location and keeps its geometry (and resolution() tags); an import
+	 * placed many times is one TShape, not a copy per placement */
+	TopoDS_Shape build_transform(gp_Trsf tx)
+	{
+		TopoDS_Shape shp = build_group_shape();
+		return shp.Moved(TopLoc_Location(tx));
+	}
+
+	/* the transforms placing the extra copies of a mirror()/symmetric()/
+	 * pattern_*() body; the body itself stays where it is */
+	std::vector<gp_Trsf> get_copies()
+	{
+		std::vector<gp_Trsf> r;
+		switch (type) {
+		case MIRROR: {
+			gp_Trsf tx;
+			tx.SetMirror(gp_Ax2(gp_Pnt(), gp_Dir(mirror.n.x, mirror.n.y, mirror.n.z)));
+			r.push_back(tx);
+			} break;
+		case SYMMETRIC:
+			for (int i = 1; i < symmetric.n; i++) {
+				gp_Trsf tx;
+				tx.SetRotation(
+					gp_Ax1(gp_Pnt(), gp_Dir(symmetric.axis.x, symmetric.axis.y, symmetric.axis.z)),
+					(2*M_PI*i) / symmetric.n
+				);
+				r.push_back(tx);
+			}
+			break;
+		case PATTERN_LINEAR:
+			for (int i = 1; i < pattern_linear.count; i++) {
+				const v3 d = pattern_linear.step * i;
+				gp_Trsf tx;
+				tx.SetTranslation(gp_Vec(d.x, d.y, d.z));
+				r.push_back(tx);
+			}
+			break;
+		case PATTERN_POLAR:
+			for (int i = 1; i < pattern_polar.count; i++) {
+				gp_Trsf tx;
+				tx.SetRotation(
+					gp_Ax1(gp_Pnt(), gp_Dir(pattern_polar.axis.x, pattern_polar.axis.y, pattern_polar.axis.z)),
+					deg2rad(pattern_polar.degrees * i)
+				);
+				r.push_back(tx);
+			}
+			break;
+		default:
+			assert(!"not a replicating node");
+		}
+		return r;
+	}
+
+	/* the body is built once; the copies are placed by transform (sharing
+	 * its geometry where they can) and glued on, which is much cheaper
+	 * than a general fuse since they only touch */
+	TopoDS_Shape build_replicated()
+	{
+		if (children.size() == 0) return TopoDS_Shape();
+		TopoDS_Shape body = fuse_all();
+		std::vector<gp_Trsf> copies = get_copies();
+		if (copies.size() == 0) return body;
+		TopTools_ListOfShape tools;
+		for (int i = 0; i < copies.size(); i++) {
+			BRepBuilderAPI_Transform mk(body, copies[i]);
+			carry_resolutions(body, mk);
+			tools.Append(mk.Shape());
+		}
+		TopoDS_Shape r = run_boolean<BRepAlgoAPI_Fuse>(body, tools, BOPAlgo_GlueShift);
+		if (run_unify_booleans) r = unify_same_domain(r);
+		return r;
+	}
+
+	/* the body is built once and the copies are the same shape at other
+	 * locations, so they share all its geometry. Unlike mirror() the
+	 * result is not fused: it is a compound, which an enclosing boolean
+	 * takes as one tool */
+	TopoDS_Shape build_pattern()
+	{
+		TopoDS_Shape body = build_group_shape();
+		if (body.IsNull()) return body;
+		std::vector<gp_Trsf> copies = get_copies();
+		TopoDS_Compound shp;
+		BRep_Builder b;
+		b.MakeCompound(shp);
+		b.Add(shp, body);
+		for (int i = 0; i < copies.size(); i++) b.Add(shp, body.Moved(TopLoc_Location(copies[i])));
+		return shp;
+	}
+
+	bool is_pattern()
+	{
+		return type == PATTERN_LINEAR || type == PATTERN_POLAR;
+	}
+
+	/* offsets fail on shapes they cannot handle (e.g. self-intersecting
+	 * results); there is no sensible shape to go on with */
+	TopoDS_Shape offset_result(BRepOffsetAPI_MakeOffsetShape& mk)
+	{
+		if (!mk.IsDone()) {
+			fprintf(stderr, "%s failed\n", label().c_str());
+			exit(EXIT_FAILURE);
+		}
+		return mk.Shape();
+	}
+
+	TopoDS_Shape fuse_all()
+	{
+		if (children.size() == 0) return TopoDS_Shape();
+		TopoDS_Shape r = children[0]->build_shape_rec();
+		for (int i = 1; i < children.size(); i++) {
+			r = run_boolean<BRepAlgoAPI_Fuse>(r, children[i]->build_shape_rec());
+		}
+		return r;
+	}
+
+	bool is_transform()
+	{
+		switch (type) {
+		case TRANSLATE:
+		case ROTATE:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	gp_Trsf get_transform()
+	{
+		switch (type) {
+		case TRANSLATE: {
+			gp_Trsf tx;
+			tx.SetTranslation(gp_Vec(translate.v.x, translate.v.y, translate.v.z));
+			return tx;
+		}
+
+		case ROTATE: {
+			gp_Trsf tx;
+			tx.SetRotation(
+				gp_Ax1(gp_Pnt(), gp_Dir(rotate.axis.x, rotate.axis.y, rotate.axis.z)),
+				deg2rad(rotate.degrees)
+			);
+			return tx;
+		}
+
+		default:
+			assert(!"not a transform");
+		}
+	}
+
+	/* the nodes that can hang or crash OCCT, and so are worth a worker */
+	bool is_expensive()
+	{
+		switch (type) {
+		case CUT:
+		case FUSE:
+		case COMMON:
+		case FILLET:
+		case SHELL:
+		case OFFSET:
+		case MIRROR:
+		case SYMMETRIC:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/* sorts the expensive nodes not built yet by how deep expensive
+	 * nodes nest below and including them (level 1 has none below);
+	 * returns that depth for this subtree */
+	int collect_isolated_subtrees(std::vector<std::vector<node*>>& by_level)
+	{
+		if (prebuilt_shapes.count(this)) return 0;
+		int level = 0;
+		for (int i = 0; i < children.size(); i++) level = std::max(level, children[i]->collect_isolated_subtrees(by_level));
+		if (!is_expensive()) return level;
+		level++;
+		if (by_level.size() < level) by_level.resize(level);
+		by_level[level-1].push_back(this);
+		return level;
+	}
+
+	/* builds every boolean, fillet, offset and glued copy in forked
+	 * worker processes, innermost first, so each runs under the budget;
+	 * a round's workers start from the shapes the rounds before built */
+	void build_isolated()
+	{
+		/* a forked child only gets this thread; the writer thread
+		 * could be holding locks the child would then need */
+		writer_pipeline.drain();
+
+		scope_timer ST("build isolated subtrees");
+
+		std::vector<std::vector<node*>> by_level;
+		collect_isolated_subtrees(by_level);
+		for (int i = 0; i < by_level.size(); i++) build_in_workers(by_level[i]);
+	}
+
+	/* builds the subtrees in forked worker processes, up to --jobs at a
+	 * time; each worker sends its shape back over a pipe in binary BRep
+	 * format (size first), followed by its resolution() tags. Workers that crash or exceed the time budget are reported
+	 * and replaced by an empty shape so the rest of the object still
+	 * builds */
+	void build_in_workers(const std::vector<node*>& subtrees)
+	{
+		const int max_jobs = job_limit();
+		const double budget = run_budget ? atof(run_budget) : 0;
+
+		struct worker {
+			int index;
+			pid_t pid;
+			int fd;
+			std::string data;
+			stopwatch sw;
+		};
+		std::vector<worker> running;
+
+		auto empty_shape = []() -> TopoDS_Shape {
+			TopoDS_Compound shp;
+			BRep_Builder b;
+			b.MakeCompound(shp);
+			return shp;
+		};
+
+		auto report = [&](int index, const char* what) {
+			printf("subtree %d (", index);
+			subtrees[index]->dump_label();
+			printf(") %s\n", what);
+		};
+
+		auto finish = [&](int wi, bool timed_out) {
+			worker& w = running[wi];
+			close(w.fd);
+			if (timed_out) kill(w.pid, SIGKILL);
+			int status;
+			waitpid(w.pid, &status, 0);
+
+			node* n = subtrees[w.index];
+			char what[128];
+			if (timed_out) {
+				snprintf(what, sizeof what, "exceeded budget of %.1fs; killed", budget);
+				report(w.index, what);
+				prebuilt_shapes[n] = empty_shape();
+			} else if (WIFSIGNALED(status)) {
+				snprintf(what, sizeof what, "crashed with signal %d", WTERMSIG(status));
+				report(w.index, what);
+				prebuilt_shapes[n] = empty_shape();
+			} else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				report(w.index, "failed");
+				prebuilt_shapes[n] = empty_shape();
+			} else {
+				uint64_t size = 0;
+				if (w.data.size() >= sizeof size) memcpy(&size, w.data.data(), sizeof size);
+				if (w.data.size() < sizeof size + size) {
+					report(w.index, "sent a short shape");
+					prebuilt_shapes[n] = empty_shape();
+				} else {
+					std::istringstream is(w.data.substr(sizeof size, size));
+					TopoDS_Shape shp;
+					BinTools::Read(shp, is);
+					read_resolutions(shp, w.data.substr(sizeof size + size));
+					prebuilt_shapes[n] = shp;
+					printf("[ %.3fs ] subtree %d\n", w.sw.time(), w.index);
+				}
+			}
+			running.erase(running.begin() + wi);
+		};
+
+		int next = 0;
+		while (next < subtrees.size() || running.size() > 0) {
+			while (next < subtrees.size() && running.size() < max_jobs) {
+				int fds[2];
+				if (pipe(fds) != 0) {
+					fprintf(stderr, "pipe: %s\n", strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+				fflush(stdout);
+				fflush(stderr);
+				pid_t pid = fork();
+				if (pid < 0) {
+					fprintf(stderr, "fork: %s\n", strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+				if (pid == 0) {
+					in_isolated_worker = true;
+					close(fds[0]);
+					TopoDS_Shape shp = subtrees[next]->build_shape_rec();
+					std::ostringstream os;
+					BinTools::Write(shp, os);
+					const std::string brep = os.str();
+					const uint64_t size = brep.size();
+					const std::string data = std::string((const char*)&size, sizeof size) + brep + write_resolutions(shp);
+					size_t written = 0;
+					while (written < data.size()) {
+						ssize_t n = write(fds[1], data.data() + written, data.size() - written);
+						if (n <= 0) _exit(EXIT_FAILURE);
+						written += n;
+					}
+					close(fds[1]);
+					fflush(stdout);
+					_exit(EXIT_SUCCESS);
+				}
+				close(fds[1]);
+				worker w;
+				w.index = next++;
+				w.pid = pid;
+				w.fd = fds[0];
+				w.sw.reset();
+				running.push_back(w);
+			}
+
+			/* wait for output, but never past the earliest deadline */
+			int timeout_ms = -1;
+			if (budget > 0) {
+				for (int i = 0; i < running.size(); i++) {
+					int left = (int)ceil((budget - running[i].sw.time()) * 1000);
+					if (left < 0) left = 0;
+					if (timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+				}
+			}
+			if (run_deadline) {
+				int left = (int)ceil((atof(run_deadline) - run_clock.time()) * 1000);
+				if (left < 0) left = 0;
+				if (timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+			}
+
+			std::vector<struct pollfd> pfds(running.size());
+			for (int i = 0; i < running.size(); i++) {
+				pfds[i].fd = running[i].fd;
+				pfds[i].events = POLLIN;
+				pfds[i].revents = 0;
+			}
+			if (poll(pfds.data(), pfds.size(), timeout_ms) < 0 && errno != EINTR) {
+				fprintf(stderr, "poll: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+
+			if (is_cancelled()) {
+				progress.running.clear();
+				for (int i = 0; i < running.size(); i++) {
+					kill(running[i].pid, SIGKILL);
+					waitpid(running[i].pid, NULL, 0);
+					if (i > 0) progress.running += ", ";
+					progress.running += subtrees[running[i].index]->label();
+				}
+				check_cancel();
+			}
+
+			for (int i = running.size()-1; i >= 0; i--) {
+				if (budget > 0 && running[i].sw.time() >= budget) {
+					finish(i, true);
+				} else if (pfds[i].revents) {
+					char buf[65536];
+					ssize_t n = read(running[i].fd, buf, sizeof buf);
+					if (n > 0) {
+						running[i].data.append(buf, n);
+						continue;
+					}
+					if (n < 0 && errno == EINTR) continue;
+					finish(i, false);
+				}
+			}
+		}
+	}
+
+	/* nodes build_shape_rec() visits; face{} outlines are read by the face */
+	int count_build_nodes()
+	{
+		int n = 1;
+		if (type == FACE) return n;
+		for (int i = 0; i < children.size(); i++) n += children[i]->count_build_nodes();
+		return n;
+	}
+
+	TopoDS_Shape build_shape_rec()
+	{
+		auto prebuilt = prebuilt_shapes.find(this);
+		if (prebuilt != prebuilt_shapes.end()) {
+			progress.done += count_build_nodes();
+			TopoDS_Shape r = prebuilt->second;
+			if (run_low_memory) prebuilt_shapes.erase(prebuilt);
+			return r;
+		}
+
+		const std::string parent = progress.running;
+		progress.running = label();
+		check_cancel();
+		report_progress();
+		TopoDS_Shape r = build_shape_node();
+		progress.running = parent;
+		progress.done++;
+		return r;
+	}
+
+	TopoDS_Shape build_shape_node()
+	{
+		switch (type) {
+		case MKOBJ:
+		case GROUP:
+			return build_group_shape();
+
+		case TRANSLATE:
 		case ROTATE:
 			return build_transform(get_transform());
 
@@ -357,24 +3690,34 @@ struct node {
 		case CYLINDER: return BRepPrimAPI_MakeCylinder(gp_Ax2(gp_Pnt(), gp::DZ()), cylinder.radius, cylinder.height);
 		case CONE: return BRepPrimAPI_MakeCone(gp_Ax2(gp_Pnt(), gp::DZ()), cone.r0, cone.r1, cone.height);
 		case SPHERE: return BRepPrimAPI_MakeSphere(sphere.radius);
+		case IMPORT_BREP: return load_brep(import_brep.path);
 
 		case CUT:
 		case FUSE:
 		case COMMON: {
 			if (children.size() == 0) return TopoDS_Shape();
 			TopoDS_Shape r = children[0]->build_shape_rec();
+			/* consecutive patterns cut or fuse in one boolean, all their
+			 * copies as tools; common() with two patterns is not common()
+			 * with their union, so there each pattern goes alone */
+			TopTools_ListOfShape tools;
 			for (int i = 1; i < children.size(); i++) {
 				TopoDS_Shape o = children[i]->build_shape_rec();
+				if (!o.IsNull()) tools.Append(o);
+				const bool batch = type != COMMON && children[i]->is_pattern() && i+1 < children.size() && children[i+1]->is_pattern();
+				if (batch || tools.IsEmpty()) continue;
 				if (type == CUT) {
-					r = BRepAlgoAPI_Cut(r, o);
+					r = run_tile_booleans ? run_tiled_boolean<BRepAlgoAPI_Cut>(r, tools, true) : run_boolean<BRepAlgoAPI_Cut>(r, tools);
 				} else if (type == FUSE) {
-					r = BRepAlgoAPI_Fuse(r, o);
+					r = run_boolean<BRepAlgoAPI_Fuse>(r, tools);
 				} else if (type == COMMON) {
-					r = BRepAlgoAPI_Common(r, o);
+					r = run_tile_booleans ? run_tiled_boolean<BRepAlgoAPI_Common>(r, tools, false) : run_boolean<BRepAlgoAPI_Common>(r, tools);
 				} else {
 					assert(!"unhandled type");
 				}
+				tools.Clear();
 			}
+			if (run_unify_booleans) r = unify_same_domain(r);
 			return r;
 		}
 
@@ -386,27 +3729,108 @@ struct node {
 					TopoDS_Edge edge = TopoDS::Edge(it.Current());
 					mk_fillet.Add(fillet.radius, edge);
 				}
+				mk_fillet.Build();
+				check_cancel();
 				return mk_fillet.Shape();
 			} else {
 				return fuse_all();
 			}
 		}
 
-		case PRISM: return BRepPrimAPI_MakePrism(build_group_shape(), gp_Vec(prism.v.x, prism.v.y, prism.v.z), true);
+		case SHELL: {
+			/* the open faces are the planar ones facing along an open
+			 * direction */
+			TopoDS_Shape r = fuse_all();
+			TopTools_ListOfShape open_faces;
+			for (TopExp_Explorer it(r, TopAbs_FACE); it.More(); it.Next()) {
+				const TopoDS_Face& fac = TopoDS::Face(it.Current());
+				if (Handle(Geom_Plane)::DownCast(BRep_Tool::Surface(fac)).IsNull()) continue;
+				BRepGProp_Face props(fac);
+				double u0, u1, v0, v1;
+				props.Bounds(u0, u1, v0, v1);
+				gp_Pnt p;
+				gp_Vec n;
+				props.Normal((u0+u1)/2, (v0+v1)/2, p, n);
+				const v3 nv = v3(n.X(), n.Y(), n.Z()).unit();
+				for (int i = 0; i < shell.n_open; i++) {
+					if (nv.dot(shell.open[i].unit()) > 1 - 1e-9) {
+						open_faces.Append(fac);
+						break;
+					}
+				}
+			}
+			BRepOffsetAPI_MakeThickSolid mk;
+			mk.MakeThickSolidByJoin(r, open_faces, -shell.thickness, 1e-6);
+			check_cancel();
+			return offset_result(mk);
+		}
+
+		case OFFSET: {
+			BRepOffsetAPI_MakeOffsetShape mk;
+			mk.PerformByJoin(fuse_all(), offset.distance, 1e-6);
+			check_cancel();
+			return offset_result(mk);
+		}
+
+		case RESOLUTION: {
+			TopoDS_Shape r = build_group_shape();
+			face_resolution res;
+			res.linear_deflection = resolution.linear_deflection;
+			res.angular_deflection = resolution.angular_deflection;
+			for (TopExp_Explorer it(r, TopAbs_FACE); it.More(); it.Next()) {
+				tag_resolution(TopoDS::Face(it.Current()), res);
+			}
+			return r;
+		}
+
+		case PRISM: return BRepPrimAPI_MakePrism(build_group_shape(), gp_Vec(prism.v.x, prism.v.y, prism.v.z), true);
+
+		case REVOLVE: {
+			const v3& a = revolve.axis;
+			return BRepPrimAPI_MakeRevol(build_group_shape(), gp_Ax1(gp_Pnt(), gp_Dir(a.x, a.y, a.z)), deg2rad(revolve.degrees), true);
+		}
+
+		case MIRROR:
+		case SYMMETRIC:
+			return build_replicated();
+
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR:
+			return build_pattern();
 
 		case FACE: {
+			/* every move_to() after the first edge and every circle()
+			 * starts another loop; the first loop is the outline and
+			 * the others are holes in it */
 			gp_Pnt cursor;
+			std::vector<TopoDS_Wire> wires;
 			BRepBuilderAPI_MakeWire mk_wire;
+			bool has_edges = false;
+			auto end_loop = [&]() {
+				if (!has_edges) return;
+				assert(mk_wire.IsDone());
+				wires.push_back(mk_wire.Wire());
+				mk_wire = BRepBuilderAPI_MakeWire();
+				has_edges = false;
+			};
 			for (int i = 0; i < children.size(); i++) {
 				node* c = children[i];
 				switch (c->type) {
 				case MOVE_TO:
+					end_loop();
 					cursor = v3_to_gp_Pnt(c->move_to.p);
 					break;
+				case CIRCLE: {
+					end_loop();
+					const v3& n = c->circle.normal;
+					gp_Circ circ(gp_Ax2(v3_to_gp_Pnt(c->circle.center), gp_Dir(n.x, n.y, n.z)), c->circle.radius);
+					wires.push_back(BRepBuilderAPI_MakeWire(BRepBuilderAPI_MakeEdge(circ)));
+					} break;
 				case LINE_TO: {
 					gp_Pnt p = v3_to_gp_Pnt(c->line_to.p);
 					Handle(Geom_TrimmedCurve) tc = GC_MakeSegment(cursor, p);
 					mk_wire.Add(BRepBuilderAPI_MakeEdge(tc));
+					has_edges = true;
 					cursor = p;
 					} break;
 				case CIRCLE_ARC_TO: {
@@ -414,20 +3838,31 @@ struct node {
 					gp_Pnt p = v3_to_gp_Pnt(c->circle_arc_to.p);
 					Handle(Geom_TrimmedCurve) tc = GC_MakeArcOfCircle(cursor, via, p);
 					mk_wire.Add(BRepBuilderAPI_MakeEdge(tc));
+					has_edges = true;
 					cursor = p;
 					} break;
 				default:
-					assert(!"invalid face child; not move_to/line_to/circle_arc_to");
+					assert(!"invalid face child; not move_to/line_to/circle_arc_to/circle");
 				}
 			}
-			assert(mk_wire.IsDone());
-			return BRepBuilderAPI_MakeFace(mk_wire.Wire());
+			end_loop();
+			assert(wires.size() > 0);
+			if (wires.size() == 1) return BRepBuilderAPI_MakeFace(wires[0]);
+
+			BRepBuilderAPI_MakeFace mk_face(wires[0]);
+			for (int i = 1; i < wires.size(); i++) mk_face.Add(wires[i]);
+			/* holes have to run against the outline; ShapeFix_Face
+			 * orients them whichever way they were drawn */
+			ShapeFix_Face fix(mk_face.Face());
+			fix.Perform();
+			return fix.Face();
 		}
 
 		case MOVE_TO:
 		case LINE_TO:
 		case CIRCLE_ARC_TO:
-			assert(!"invalid move_to/line_to/circle_arc_to; must be inside face{}");
+		case CIRCLE:
+			assert(!"invalid move_to/line_to/circle_arc_to/circle; must be inside face{}");
 			break;
 
 		}
@@ -435,96 +3870,1030 @@ struct node {
 		assert(!"unhandled type");
 	}
 
+	/* flattens the loops of a face{} (outline first, then holes) to
+	 * polylines; arcs are split into segments spanning at most max_angle
+	 * radians, and deviating at most linear_deflection from the arc if
+	 * that is given */
+	void flatten_face(std::vector<std::vector<v3>>& loops, double max_angle, double linear_deflection = 0, bool is_relative = false)
+	{
+		assert(type == FACE);
+		auto arc_segments = [&](double r, double sweep) {
+			double seg_angle = max_angle;
+			const double lin = is_relative ? linear_deflection * r : linear_deflection;
+			if (lin > 0 && lin < r) seg_angle = fmin(seg_angle, 2*acos(1 - lin/r));
+			return (int)ceil(sweep / seg_angle);
+		};
+		/* the loops are implicitly closed */
+		auto end_loop = [&]() {
+			std::vector<v3>& pts = loops.back();
+			if (pts.size() > 1 && (pts.front()-pts.back()).length() < 1e-9) pts.pop_back();
+		};
+		v3 cursor;
+		bool has_edges = false;
+		loops.push_back(std::vector<v3>());
+		for (int i = 0; i < children.size(); i++) {
+			node* c = children[i];
+			switch (c->type) {
+			case MOVE_TO:
+				if (has_edges) {
+					end_loop();
+					loops.push_back(std::vector<v3>());
+					has_edges = false;
+				} else {
+					loops.back().clear();
+				}
+				cursor = c->move_to.p;
+				break;
+			case CIRCLE: {
+				if (has_edges) {
+					end_loop();
+					loops.push_back(std::vector<v3>());
+				}
+				std::vector<v3>& pts = loops.back();
+				pts.clear();
+				const v3 n = c->circle.normal.unit();
+				const v3 u = (fabs(n.x) < 0.9 ? v3(1,0,0) : v3(0,1,0)).cross(n).unit();
+				const v3 w = n.cross(u);
+				const double r = c->circle.radius;
+				const int n_segments = std::max(3, arc_segments(r, 2*M_PI));
+				for (int j = 0; j < n_segments; j++) {
+					const double t = 2*M_PI * j / n_segments;
+					pts.push_back(c->circle.center + u*(cos(t)*r) + w*(sin(t)*r));
+				}
+				loops.push_back(std::vector<v3>(1, cursor));
+				has_edges = false;
+				} continue;
+			case LINE_TO:
+				cursor = c->line_to.p;
+				has_edges = true;
+				break;
+			case CIRCLE_ARC_TO: {
+				const v3 a = cursor, b = c->circle_arc_to.via, p = c->circle_arc_to.p;
+				const v3 ab = b-a, ap = p-a;
+				const v3 n = ab.cross(ap);
+				const v3 center = a + (ap.cross(n) * ab.dot(ab) + n.cross(ab) * ap.dot(ap)) / (2 * n.dot(n));
+				const double r = (a-center).length();
+				const v3 u = (a-center).unit();
+				const v3 w = n.unit().cross(u);
+				double sweep = atan2((p-center).dot(w), (p-center).dot(u));
+				if (sweep <= 0) sweep += 2*M_PI;
+				const int n_segments = arc_segments(r, sweep);
+				for (int j = 1; j < n_segments; j++) {
+					const double t = sweep * j / n_segments;
+					loops.back().push_back(center + u*(cos(t)*r) + w*(sin(t)*r));
+				}
+				cursor = p;
+				has_edges = true;
+				} break;
+			default:
+				assert(!"invalid face child; not move_to/line_to/circle_arc_to/circle");
+			}
+			loops.back().push_back(cursor);
+		}
+		end_loop();
+		/* a trailing move_to() or circle() leaves a loop without edges */
+		if (!has_edges && loops.size() > 1) loops.pop_back();
+	}
+
+	/* more than one loop; holed faces stay off the analytic path */
+	bool has_holes()
+	{
+		assert(type == FACE);
+		std::vector<std::vector<v3>> loops;
+		flatten_face(loops, M_PI/2);
+		return loops.size() > 1;
+	}
+
+	void local_bounds(v3& mn, v3& mx)
+	{
+		switch (type) {
+		case BOX: mn = v3(); mx = box.size; break;
+		case WEDGE: mn = v3(); mx = v3(fmax(wedge.size.x, wedge.ltx), wedge.size.y, wedge.size.z); break;
+		case SPHERE: mn = v3(-1,-1,-1) * sphere.radius; mx = v3(1,1,1) * sphere.radius; break;
+		case CYLINDER: mn = v3(-cylinder.radius, -cylinder.radius, 0); mx = v3(cylinder.radius, cylinder.radius, cylinder.height); break;
+		case CONE: {
+			double r = fmax(cone.r0, cone.r1);
+			mn = v3(-r, -r, 0);
+			mx = v3(r, r, cone.height);
+			} break;
+		case IMPORT_BREP: {
+			Bnd_Box bb;
+			BRepBndLib::Add(load_brep(import_brep.path), bb);
+			if (bb.IsVoid()) {
+				mn = mx = v3();
+				break;
+			}
+			double x0, y0, z0, x1, y1, z1;
+			bb.Get(x0, y0, z0, x1, y1, z1);
+			mn = v3(x0, y0, z0);
+			mx = v3(x1, y1, z1);
+			} break;
+		default: assert(!"no local bounds");
+		}
+	}
+
+	bool local_inside(const v3& p)
+	{
+		switch (type) {
+		case BOX:
+			return p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x <= box.size.x && p.y <= box.size.y && p.z <= box.size.z;
+		case WEDGE: {
+			if (p.y < 0 || p.y > wedge.size.y || p.z < 0 || p.z > wedge.size.z || p.x < 0) return false;
+			double t = p.y / wedge.size.y;
+			return p.x <= wedge.size.x + (wedge.ltx - wedge.size.x) * t;
+		}
+		case SPHERE:
+			return p.dot(p) <= sphere.radius*sphere.radius;
+		case CYLINDER:
+			return p.z >= 0 && p.z <= cylinder.height && p.x*p.x + p.y*p.y <= cylinder.radius*cylinder.radius;
+		case CONE: {
+			if (p.z < 0 || p.z > cone.height) return false;
+			double r = cone.r0 + (cone.r1 - cone.r0) * (p.z / cone.height);
+			return p.x*p.x + p.y*p.y <= r*r;
+		}
+		default: assert(!"no inside test");
+		}
+	}
+
+	/* frame of a revolve() profile: a along the axis (flipped for
+	 * negative degrees), e in the profile plane pointing from the axis
+	 * to the profile, and f = a x e, the way the profile turns. False if
+	 * the profile plane crosses the axis */
+	bool revolve_frame(const std::vector<v3>& outline, v3& a, v3& e, v3& f)
+	{
+		a = revolve.axis.unit();
+		if (revolve.degrees < 0) a = -a;
+		flat_polygon poly;
+		poly.init(outline);
+		e = a.cross(poly.n);
+		if (e.length() < 1e-9) return false;
+		e = e.unit();
+		double side = 0;
+		for (int i = 0; i < outline.size(); i++) side += outline[i].dot(e);
+		if (side < 0) e = -e;
+		f = a.cross(e);
+		return true;
+	}
+
+	/* local bounds of the cylinder around the axis that holds whatever
+	 * a revolve() of outline sweeps */
+	static void revolve_bounds(const std::vector<v3>& outline, const v3& a, const v3& e, const v3& f, v3& mn, v3& mx)
+	{
+		double r = 0, h0 = INFINITY, h1 = -INFINITY;
+		for (int i = 0; i < outline.size(); i++) {
+			const double h = outline[i].dot(a);
+			r = fmax(r, (outline[i] - a*h).length());
+			h0 = fmin(h0, h);
+			h1 = fmax(h1, h);
+		}
+		mn = v3(INFINITY, INFINITY, INFINITY);
+		mx = -mn;
+		for (int j = 0; j < 8; j++) {
+			const v3 p = e*((j&1) ? r : -r) + f*((j&2) ? r : -r) + a*((j&4) ? h1 : h0);
+			for (int k = 0; k < 3; k++) {
+				mn.s[k] = fmin(mn.s[k], p.s[k]);
+				mx.s[k] = fmax(mx.s[k], p.s[k]);
+			}
+		}
+	}
+
+	void preview_bounds(const gp_Trsf& tx, v3& mn, v3& mx)
+	{
+		auto add = [&](const v3& p) {
+			gp_Pnt w = v3_to_gp_Pnt(p).Transformed(tx);
+			for (int j = 0; j < 3; j++) {
+				double c = j == 0 ? w.X() : j == 1 ? w.Y() : w.Z();
+				mn.s[j] = fmin(mn.s[j], c);
+				mx.s[j] = fmax(mx.s[j], c);
+			}
+		};
+
+		switch (type) {
+		case TRANSLATE:
+		case ROTATE: {
+			gp_Trsf ctx = tx * get_transform();
+			for (int i = 0; i < children.size(); i++) children[i]->preview_bounds(ctx, mn, mx);
+			} break;
+
+		case MIRROR:
+		case SYMMETRIC:
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR: {
+			std::vector<gp_Trsf> copies = get_copies();
+			copies.push_back(gp_Trsf());
+			for (int j = 0; j < copies.size(); j++) {
+				for (int i = 0; i < children.size(); i++) children[i]->preview_bounds(tx * copies[j], mn, mx);
+			}
+			} break;
+
+		case CUT:
+		case COMMON:
+			/* the result never extends beyond the first operand */
+			if (children.size() > 0) children[0]->preview_bounds(tx, mn, mx);
+			break;
+
+		case OFFSET: {
+			v3 cmn(INFINITY, INFINITY, INFINITY), cmx(-INFINITY, -INFINITY, -INFINITY);
+			for (int i = 0; i < children.size(); i++) children[i]->preview_bounds(tx, cmn, cmx);
+			if (cmn.x > cmx.x) break;
+			const double grow = fmax(offset.distance, 0);
+			for (int j = 0; j < 3; j++) {
+				mn.s[j] = fmin(mn.s[j], cmn.s[j] - grow);
+				mx.s[j] = fmax(mx.s[j], cmx.s[j] + grow);
+			}
+			} break;
+
+		case PRISM:
+			for (int i = 0; i < children.size(); i++) {
+				if (children[i]->type != FACE) continue;
+				/* holes are inside the outline */
+				std::vector<std::vector<v3>> loops;
+				children[i]->flatten_face(loops, M_PI/8);
+				if (loops.empty()) continue;
+				const std::vector<v3>& pts = loops[0];
+				for (int j = 0; j < pts.size(); j++) {
+					add(pts[j]);
+					add(pts[j] + prism.v);
+				}
+			}
+			break;
+
+		case REVOLVE:
+			for (int i = 0; i < children.size(); i++) {
+				if (children[i]->type != FACE) continue;
+				std::vector<std::vector<v3>> loops;
+				children[i]->flatten_face(loops, M_PI/8);
+				v3 a, e, f;
+				if (loops.empty() || loops[0].size() < 3 || !revolve_frame(loops[0], a, e, f)) continue;
+				v3 lmn, lmx;
+				revolve_bounds(loops[0], a, e, f, lmn, lmx);
+				for (int j = 0; j < 8; j++) add(v3((j&1) ? lmx.x : lmn.x, (j&2) ? lmx.y : lmn.y, (j&4) ? lmx.z : lmn.z));
+			}
+			break;
+
+		case FACE:
+			break;
+
+		default:
+			if (is_leaf()) {
+				v3 lmn, lmx;
+				local_bounds(lmn, lmx);
+				for (int i = 0; i < 8; i++) add(v3((i&1) ? lmx.x : lmn.x, (i&2) ? lmx.y : lmn.y, (i&4) ? lmx.z : lmn.z));
+			} else {
+				for (int i = 0; i < children.size(); i++) children[i]->preview_bounds(tx, mn, mx);
+			}
+			break;
+		}
+	}
+
+	/* sets voxels inside this subtree to value */
+	void preview_rec(voxel_grid& g, const gp_Trsf& tx, bool value)
+	{
+		switch (type) {
+		case MKOBJ:
+		case GROUP:
+		case FUSE:
+		case RESOLUTION:
+		case FILLET: /* fillets are skipped in previews */
+			for (int i = 0; i < children.size(); i++) children[i]->preview_rec(g, tx, value);
+			break;
+
+		case TRANSLATE:
+		case ROTATE: {
+			gp_Trsf ctx = tx * get_transform();
+			for (int i = 0; i < children.size(); i++) children[i]->preview_rec(g, ctx, value);
+			} break;
+
+		case MIRROR:
+		case SYMMETRIC:
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR: {
+			std::vector<gp_Trsf> copies = get_copies();
+			copies.push_back(gp_Trsf());
+			for (int j = 0; j < copies.size(); j++) {
+				for (int i = 0; i < children.size(); i++) children[i]->preview_rec(g, tx * copies[j], value);
+			}
+			} break;
+
+		case CUT:
+		case COMMON: {
+			if (children.size() == 0) break;
+			voxel_grid r = g.empty_like();
+			children[0]->preview_rec(r, tx, true);
+			for (int i = 1; i < children.size(); i++) {
+				if (type == CUT) {
+					children[i]->preview_rec(r, tx, false);
+				} else {
+					voxel_grid o = g.empty_like();
+					children[i]->preview_rec(o, tx, true);
+					for (size_t j = 0; j < r.cells.size(); j++) r.cells[j] &= o.cells[j];
+				}
+			}
+			g.apply(r, value);
+			} break;
+
+		case OFFSET: {
+			voxel_grid r = g.empty_like();
+			for (int i = 0; i < children.size(); i++) children[i]->preview_rec(r, tx, true);
+			r.grow(offset.distance);
+			g.apply(r, value);
+			} break;
+
+		case SHELL: {
+			voxel_grid r = g.empty_like();
+			for (int i = 0; i < children.size(); i++) children[i]->preview_rec(r, tx, true);
+			voxel_grid cavity = r;
+			cavity.grow(-shell.thickness);
+
+			/* an open face lets the cavity through the wall beyond it:
+			 * carry the cavity along each open direction until it leaves
+			 * the body */
+			const voxel_grid inner = cavity;
+			for (int i = 0; i < shell.n_open; i++) {
+				const v3 o = shell.open[i];
+				gp_Vec d = gp_Vec(o.x, o.y, o.z).Transformed(tx);
+				const v3 dir = v3(d.X(), d.Y(), d.Z()).unit();
+				for (int z = 0; z < g.nz; z++) for (int y = 0; y < g.ny; y++) for (int x = 0; x < g.nx; x++) {
+					if (!inner.cells[g.index(x,y,z)]) continue;
+					int c[3];
+					auto cell_at = [&](double t) {
+						for (int k = 0; k < 3; k++) c[k] = (int)floor((k == 0 ? x : k == 1 ? y : z) + dir.s[k]*t + 0.5);
+					};
+					/* the last inner cell along dir carries it for the rest */
+					cell_at(1);
+					if (inner.get(c[0], c[1], c[2])) continue;
+					for (double t = 0.5; ; t += 0.5) {
+						cell_at(t);
+						if (!r.get(c[0], c[1], c[2])) break;
+						cavity.cells[g.index(c[0], c[1], c[2])] = 1;
+					}
+				}
+			}
+			for (size_t j = 0; j < r.cells.size(); j++) r.cells[j] &= !cavity.cells[j];
+			g.apply(r, value);
+			} break;
+
+		case BOX:
+		case WEDGE:
+		case SPHERE:
+		case CYLINDER:
+		case CONE: {
+			v3 mn, mx;
+			local_bounds(mn, mx);
+			voxel_raster(g, tx, mn, mx, value, [this](const v3& p) { return local_inside(p); });
+			} break;
+
+		case IMPORT_BREP: {
+			/* classifying against the real shape is slower than the
+			 * primitive tests, but still far cheaper than meshing it */
+			const TopoDS_Shape& shp = load_brep(import_brep.path);
+			v3 mn, mx;
+			local_bounds(mn, mx);
+			BRepClass3d_SolidClassifier cls(shp);
+			voxel_raster(g, tx, mn, mx, value, [&cls](const v3& p) {
+				cls.Perform(v3_to_gp_Pnt(p), 1e-7);
+				return cls.State() == TopAbs_IN || cls.State() == TopAbs_ON;
+			});
+			} break;
+
+		case PRISM:
+			for (int i = 0; i < children.size(); i++) {
+				if (children[i]->type != FACE) continue;
+				std::vector<std::vector<v3>> loops;
+				children[i]->flatten_face(loops, M_PI/8);
+				if (loops.empty() || loops[0].size() < 3) continue;
+				const std::vector<v3>& pts = loops[0];
+
+				flat_polygon poly;
+				poly.init(loops);
+				const v3 v = prism.v;
+				const double vn = v.dot(poly.n);
+				if (fabs(vn) < 1e-12) continue;
+
+				v3 mn(INFINITY, INFINITY, INFINITY), mx(-INFINITY, -INFINITY, -INFINITY);
+				for (int j = 0; j < pts.size(); j++) {
+					for (int k = 0; k < 3; k++) {
+						mn.s[k] = fmin(mn.s[k], fmin(pts[j].s[k], pts[j].s[k] + v.s[k]));
+						mx.s[k] = fmax(mx.s[k], fmax(pts[j].s[k], pts[j].s[k] + v.s[k]));
+					}
+				}
+
+				voxel_raster(g, tx, mn, mx, value, [&](const v3& p) {
+					const double t = (p - poly.o).dot(poly.n) / vn;
+					if (t < 0 || t > 1) return false;
+					return poly.contains(p - v*t);
+				});
+			}
+			break;
+
+		case REVOLVE:
+			for (int i = 0; i < children.size(); i++) {
+				if (children[i]->type != FACE) continue;
+				std::vector<std::vector<v3>> loops;
+				children[i]->flatten_face(loops, M_PI/8);
+				v3 a, e, f;
+				if (loops.empty() || loops[0].size() < 3 || !revolve_frame(loops[0], a, e, f)) continue;
+
+				flat_polygon poly;
+				poly.init(loops);
+				const double sweep = deg2rad(fabs(revolve.degrees));
+				v3 mn, mx;
+				revolve_bounds(loops[0], a, e, f, mn, mx);
+
+				/* turn p back into the profile plane and test it there */
+				voxel_raster(g, tx, mn, mx, value, [&](const v3& p) {
+					const double h = p.dot(a);
+					const v3 rv = p - a*h;
+					double t = atan2(rv.dot(f), rv.dot(e));
+					if (t < 0) t += 2*M_PI;
+					if (t > sweep) return false;
+					return poly.contains(e*rv.length() + a*h);
+				});
+			}
+			break;
+
+		case FACE:
+			/* a bare face has no volume */
+			break;
+
+		case MOVE_TO:
+		case LINE_TO:
+		case CIRCLE_ARC_TO:
+		case CIRCLE:
+			assert(!"invalid move_to/line_to/circle_arc_to/circle; must be inside face{}");
+			break;
+		}
+	}
+
+	mesh* build_preview_mesh()
+	{
+		scope_timer ST("build preview");
+
+		v3 mn(INFINITY, INFINITY, INFINITY), mx(-INFINITY, -INFINITY, -INFINITY);
+		preview_bounds(gp_Trsf(), mn, mx);
+		if (mn.x > mx.x) return new mesh;
+
+		int resolution = run_preview_res ? atoi(run_preview_res) : 128;
+		if (resolution < 1) resolution = 1;
+
+		voxel_grid g;
+		g.init(mn, mx, resolution);
+		preview_rec(g, gp_Trsf(), true);
+		return g.build_mesh();
+	}
+
+	/* drops faces whose bounding box lies entirely inside a cull volume
+	 * so they are never triangulated; faces only partially covered are
+	 * kept and left to the per-triangle culling in build_mesh */
+	TopoDS_Shape cull_faces(const TopoDS_Shape& shp)
+	{
+		if (cull_volumes.size() == 0) return shp;
+
+		TopoDS_Compound visible;
+		BRep_Builder b;
+		b.MakeCompound(visible);
+
+		int n_faces = 0, n_culled = 0;
+		for (TopExp_Explorer it(shp, TopAbs_FACE); it.More(); it.Next()) {
+			n_faces++;
+			Bnd_Box bb;
+			BRepBndLib::Add(it.Current(), bb, false);
+			if (!bb.IsVoid()) {
+				v3 mn, mx;
+				bb.Get(mn.x, mn.y, mn.z, mx.x, mx.y, mx.z);
+				if (is_box_culled(mn, mx)) {
+					n_culled++;
+					continue;
+				}
+			}
+			b.Add(visible, it.Current());
+		}
+		if (run_dump) printf("culled %d of %d faces before meshing\n", n_culled, n_faces);
+
+		return visible;
+	}
+
+	/* true if the subtree holds only primitives, prisms and revolves (no booleans,
+	 * fillets or bare faces) and can be tessellated directly */
+	bool is_analytic()
+	{
+		switch (type) {
+		case GROUP:
+		case TRANSLATE:
+		case ROTATE:
+		case RESOLUTION:
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR:
+			for (int i = 0; i < children.size(); i++) {
+				if (!children[i]->is_analytic()) return false;
+			}
+			return true;
+		case BOX:
+		case WEDGE:
+		case SPHERE:
+		case CYLINDER:
+		case CONE:
+			return true;
+		case PRISM:
+		case REVOLVE:
+			/* caps are ear-clipped, which needs a simple outline */
+			for (int i = 0; i < children.size(); i++) {
+				if (children[i]->type != FACE || children[i]->has_holes()) return false;
+			}
+			return children.size() > 0;
+		default:
+			return false;
+		}
+	}
+
+	/* finds analytic subtrees reachable from here through groups and
+	 * transforms; anything under a boolean stays on the BRep path */
+	void collect_analytic(const gp_Trsf& tx, double linear_deflection, double angular_deflection)
+	{
+		for (int i = 0; i < children.size(); i++) {
+			node* c = children[i];
+			if (c->is_analytic()) {
+				analytic_part part;
+				part.n = c;
+				part.tx = tx;
+				part.linear_deflection = linear_deflection;
+				part.angular_deflection = angular_deflection;
+				analytic_parts.push_back(part);
+				continue;
+			}
+			switch (c->type) {
+			case GROUP:
+				c->collect_analytic(tx, linear_deflection, angular_deflection);
+				break;
+			case TRANSLATE:
+			case ROTATE:
+				c->collect_analytic(tx * c->get_transform(), linear_deflection, angular_deflection);
+				break;
+			case RESOLUTION:
+				c->collect_analytic(tx, c->resolution.linear_deflection, c->resolution.angular_deflection);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	void tessellate_rec(mesh_builder& mb, const gp_Trsf& tx, double linear_deflection, bool is_relative, double angular_deflection)
+	{
+		auto world = [&tx](const v3& p) -> v3 {
+			return gp_Pnt_to_v3(v3_to_gp_Pnt(p).Transformed(tx));
+		};
+
+		/* primitives are convex, so triangles are oriented to face away
+		 * from a point inside them */
+		v3 center;
+		if (is_leaf()) {
+			v3 mn, mx;
+			local_bounds(mn, mx);
+			center = (mn + mx) / 2;
+		}
+		auto convex_tri = [&](const v3& a, const v3& b, const v3& c) {
+			const v3 n = (b-a).cross(c-a);
+			if (n.dot((a+b+c)/3 - center) >= 0) {
+				mb.add_triangle(world(a), world(b), world(c));
+			} else {
+				mb.add_triangle(world(c), world(b), world(a));
+			}
+		};
+		auto convex_quad = [&](const v3& a, const v3& b, const v3& c, const v3& d) {
+			convex_tri(a, b, c);
+			convex_tri(a, c, d);
+		};
+		auto segments = [&](double r) {
+			return circle_segments(r, linear_deflection, is_relative, angular_deflection);
+		};
+		/* point i of n around a circle; wrapping i keeps seams watertight */
+		auto ring = [](double r, double z, int i, int n) {
+			const double t = 2*M_PI * (i % n) / n;
+			return v3(r*cos(t), r*sin(t), z);
+		};
+
+		switch (type) {
+		case GROUP:
+			for (int i = 0; i < children.size(); i++) children[i]->tessellate_rec(mb, tx, linear_deflection, is_relative, angular_deflection);
+			break;
+
+		case TRANSLATE:
+		case ROTATE: {
+			gp_Trsf ctx = tx * get_transform();
+			for (int i = 0; i < children.size(); i++) children[i]->tessellate_rec(mb, ctx, linear_deflection, is_relative, angular_deflection);
+			} break;
+
+		case RESOLUTION:
+			for (int i = 0; i < children.size(); i++) children[i]->tessellate_rec(mb, tx, resolution.linear_deflection, is_relative, resolution.angular_deflection);
+			break;
+
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR: {
+			/* copies are tessellated directly, like a group; the BRep
+			 * pattern is an unfused compound too. mirror() and
+			 * symmetric() glue their copies, so they never get here */
+			std::vector<gp_Trsf> copies = get_copies();
+			copies.push_back(gp_Trsf());
+			for (int j = 0; j < copies.size(); j++) {
+				for (int i = 0; i < children.size(); i++) children[i]->tessellate_rec(mb, tx * copies[j], linear_deflection, is_relative, angular_deflection);
+			}
+			} break;
+
+		case BOX:
+		case WEDGE: {
+			/* a box is a wedge whose top is as wide as its bottom */
+			const double dx = type == BOX ? box.size.x : wedge.size.x;
+			const double dy = type == BOX ? box.size.y : wedge.size.y;
+			const double dz = type == BOX ? box.size.z : wedge.size.z;
+			const double tx1 = type == BOX ? box.size.x : wedge.ltx;
+			const v3 b0(0,0,0), b1(dx,0,0), b2(dx,0,dz), b3(0,0,dz);
+			const v3 t0(0,dy,0), t1(tx1,dy,0), t2(tx1,dy,dz), t3(0,dy,dz);
+			center = (b0+b1+b2+b3+t0+t1+t2+t3) / 8;
+			mb.begin_face(); convex_quad(b0, b1, b2, b3);
+			mb.begin_face(); convex_quad(t0, t1, t2, t3);
+			mb.begin_face(); convex_quad(b0, b1, t1, t0);
+			mb.begin_face(); convex_quad(b3, b2, t2, t3);
+			mb.begin_face(); convex_quad(b0, b3, t3, t0);
+			mb.begin_face(); convex_quad(b1, b2, t2, t1);
+			} break;
+
+		case SPHERE: {
+			const double r = sphere.radius;
+			const int n_lon = segments(r);
+			const int n_lat = (n_lon+1) / 2;
+			auto at = [&](int lat, int lon) {
+				if (lat == 0) return v3(0, 0, -r);
+				if (lat == n_lat) return v3(0, 0, r);
+				const double phi = M_PI * lat / n_lat - M_PI/2;
+				return ring(r*cos(phi), r*sin(phi), lon, n_lon);
+			};
+			mb.begin_face();
+			for (int lat = 0; lat < n_lat; lat++) {
+				for (int lon = 0; lon < n_lon; lon++) {
+					convex_quad(at(lat, lon), at(lat, lon+1), at(lat+1, lon+1), at(lat+1, lon));
+				}
+			}
+			} break;
+
+		case CYLINDER:
+		case CONE: {
+			const double r0 = type == CYLINDER ? cylinder.radius : cone.r0;
+			const double r1 = type == CYLINDER ? cylinder.radius : cone.r1;
+			const double h = type == CYLINDER ? cylinder.height : cone.height;
+			const int n = segments(fmax(r0, r1));
+			mb.begin_face();
+			for (int i = 0; i < n; i++) {
+				convex_quad(ring(r0, 0, i, n), ring(r0, 0, i+1, n), ring(r1, h, i+1, n), ring(r1, h, i, n));
+			}
+			for (int cap = 0; cap < 2; cap++) {
+				const double r = cap ? r1 : r0;
+				const double z = cap ? h : 0;
+				if (r <= 0) continue;
+				mb.begin_face();
+				for (int i = 0; i < n; i++) {
+					convex_tri(v3(0,0,z), ring(r, z, i, n), ring(r, z, i+1, n));
+				}
+			}
+			} break;
+
+		case PRISM:
+			for (int i = 0; i < children.size(); i++) {
+				std::vector<std::vector<v3>> loops;
+				children[i]->flatten_face(loops, angular_deflection, linear_deflection, is_relative);
+				if (loops.size() > 0) tessellate_prism(mb, tx, loops[0], prism.v);
+			}
+			break;
+
+		case REVOLVE:
+			for (int i = 0; i < children.size(); i++) {
+				std::vector<std::vector<v3>> loops;
+				children[i]->flatten_face(loops, angular_deflection, linear_deflection, is_relative);
+				if (loops.size() > 0) tessellate_revolve(mb, tx, loops[0], linear_deflection, is_relative, angular_deflection);
+			}
+			break;
+
+		default:
+			assert(!"not analytic");
+		}
+	}
+
+	/* orients the outline counter-clockwise around v and ear-clips it;
+	 * returns index triples, counter-clockwise around v too */
+	static std::vector<int> cap_triangles(std::vector<v3>& pts, const v3& v)
+	{
+		flat_polygon poly;
+		poly.init(pts);
+		if (poly.n.dot(v) < 0) {
+			std::reverse(pts.begin(), pts.end());
+			poly.init(pts);
+		}
+
+		/* ear clipping, in the polygon's own 2D frame */
+		std::vector<int> idx(pts.size());
+		for (int i = 0; i < idx.size(); i++) idx[i] = i;
+		auto cross2 = [&](int a, int b, int c) {
+			return (poly.xs[b]-poly.xs[a])*(poly.ys[c]-poly.ys[a]) - (poly.ys[b]-poly.ys[a])*(poly.xs[c]-poly.xs[a]);
+		};
+		double extent = 0;
+		for (int i = 0; i < pts.size(); i++) extent = fmax(extent, fmax(fabs(poly.xs[i]), fabs(poly.ys[i])));
+		const double eps = 1e-12 * extent * extent;
+		std::vector<int> cap;
+		while (idx.size() > 3) {
+			bool clipped = false;
+			for (int i = 0; i < idx.size(); i++) {
+				const int a = idx[(i+idx.size()-1) % idx.size()], b = idx[i], c = idx[(i+1) % idx.size()];
+				/* collinear tips are never clipped; that would leave a
+				 * T-junction against the side walls */
+				if (cross2(a, b, c) <= eps) continue;
+				bool is_ear = true;
+				for (int j = 0; j < idx.size() && is_ear; j++) {
+					const int p = idx[j];
+					if (p == a || p == b || p == c) continue;
+					if (cross2(a, b, p) >= -eps && cross2(b, c, p) >= -eps && cross2(c, a, p) >= -eps) is_ear = false;
+				}
+				if (!is_ear) continue;
+				cap.push_back(a); cap.push_back(b); cap.push_back(c);
+				idx.erase(idx.begin() + i);
+				clipped = true;
+				break;
+			}
+			if (!clipped) break; // self-intersecting outline; give up on the rest
+		}
+		if (idx.size() == 3) {
+			cap.push_back(idx[0]); cap.push_back(idx[1]); cap.push_back(idx[2]);
+		}
+		return cap;
+	}
+
+	static void tessellate_prism(mesh_builder& mb, const gp_Trsf& tx, std::vector<v3> pts, const v3& v)
+	{
+		if (pts.size() < 3) return;
+		auto world = [&tx](const v3& p) -> v3 {
+			return gp_Pnt_to_v3(v3_to_gp_Pnt(p).Transformed(tx));
+		};
+
+		const std::vector<int> cap = cap_triangles(pts, v);
+
+		mb.begin_face();
+		for (int i = 0; i < cap.size(); i += 3) {
+			mb.add_triangle(world(pts[cap[i+2]]), world(pts[cap[i+1]]), world(pts[cap[i]]));
+		}
+		mb.begin_face();
+		for (int i = 0; i < cap.size(); i += 3) {
+			mb.add_triangle(world(pts[cap[i]] + v), world(pts[cap[i+1]] + v), world(pts[cap[i+2]] + v));
+		}
+		for (int i = 0; i < pts.size(); i++) {
+			const v3& a = pts[i];
+			const v3& b = pts[(i+1) % pts.size()];
+			mb.begin_face();
+			mb.add_triangle(world(a), world(b), world(b + v));
+			mb.add_triangle(world(a), world(b + v), world(a + v));
+		}
+	}
+
+	void tessellate_revolve(mesh_builder& mb, const gp_Trsf& tx, std::vector<v3> pts, double linear_deflection, bool is_relative, double angular_deflection)
+	{
+		v3 a, e, f;
+		if (pts.size() < 3 || !revolve_frame(pts, a, e, f)) return;
+		auto world = [&tx](const v3& p) -> v3 {
+			return gp_Pnt_to_v3(v3_to_gp_Pnt(p).Transformed(tx));
+		};
+
+		/* with the outline counter-clockwise around f, the start cap is
+		 * the reversed cap and the end cap the cap as it is, like the
+		 * bottom and top of a prism */
+		const std::vector<int> cap = cap_triangles(pts, f);
+
+		/* each point as radius and height; points on the axis get radius
+		 * 0, so that every step around puts them in the same place */
+		std::vector<double> rs(pts.size()), hs(pts.size());
+		double r_max = 0;
+		for (int i = 0; i < pts.size(); i++) {
+			hs[i] = pts[i].dot(a);
+			rs[i] = (pts[i] - a*hs[i]).length();
+			r_max = fmax(r_max, rs[i]);
+		}
+		if (r_max <= 0) return;
+		for (int i = 0; i < pts.size(); i++) {
+			if (rs[i] < 1e-9 * r_max) rs[i] = 0;
+		}
+
+		const double sweep = deg2rad(fabs(revolve.degrees));
+		const bool full = sweep >= 2*M_PI - 1e-9;
+		const int n_full = circle_segments(r_max, linear_deflection, is_relative, angular_deflection);
+		const int n = std::max(1, (int)ceil(n_full * sweep / (2*M_PI) - 1e-9));
+		/* point i after step j of n; wrapping j on a full turn keeps the
+		 * seam watertight */
+		auto at = [&](int i, int j) {
+			const double t = sweep * (full ? j % n : j) / n;
+			return world(a*hs[i] + (e*cos(t) + f*sin(t)) * rs[i]);
+		};
+
+		/* one face per outline edge, as BRepPrimAPI_MakeRevol makes them;
+		 * the triangles that collapse on the axis are dropped by
+		 * add_triangle */
+		for (int i = 0; i < pts.size(); i++) {
+			const int k = (i+1) % pts.size();
+			mb.begin_face();
+			for (int j = 0; j < n; j++) {
+				mb.add_triangle(at(i, j), at(k, j), at(k, j+1));
+				mb.add_triangle(at(i, j), at(k, j+1), at(i, j+1));
+			}
+		}
+		if (full) return;
+
+		mb.begin_face();
+		for (int i = 0; i < cap.size(); i += 3) {
+			mb.add_triangle(at(cap[i+2], 0), at(cap[i+1], 0), at(cap[i], 0));
+		}
+		mb.begin_face();
+		for (int i = 0; i < cap.size(); i += 3) {
+			mb.add_triangle(at(cap[i], n), at(cap[i+1], n), at(cap[i+2], n));
+		}
+	}
+
 	mesh* build_mesh(TopoDS_Shape& shp, double linear_deflection, bool is_relative, double angular_deflection)
 	{
 		scope_timer ST("build mesh");
 
 		mesh* m = new mesh;
 
-		/* TODO the parameters should come from mkobj().. also, I might
-		 * want two sets ... one for low poly and one for high poly?
-		 * depends on whether I need high poly or not... */
-		BRepMesh_IncrementalMesh(shp, linear_deflection, is_relative, angular_deflection);
+		TopoDS_Shape visible = cull_faces(shp);
+
+		/* faces are meshed in groups sharing a resolution(), finest first,
+		 * so edges between groups keep the finer discretization; faces
+		 * outside any resolution() use the mkobj() deflections */
+		auto deflections = [&](const TopoDS_Face& fac) {
+			const face_resolution* res = find_resolution(fac);
+			return res
+				? std::make_pair(res->linear_deflection, res->angular_deflection)
+				: std::make_pair(linear_deflection, angular_deflection);
+		};
+		std::set<std::pair<double,double>> all_deflections;
+		for (TopExp_Explorer it(visible, TopAbs_FACE); it.More(); it.Next()) {
+			all_deflections.insert(deflections(TopoDS::Face(it.Current())));
+		}
 
-		std::map<v3,int,v3_less> vertex_map;
-		int n_duplicate_vertices = 0;
+		/* with --face-cache, a face only meets its neighbors along the
+		 * edges it was cached with if they are meshed with the same
+		 * deflections, since edges are discretized from their curve; faces
+		 * next to another resolution() group are always re-meshed */
+		TopTools_IndexedDataMapOfShapeListOfShape edge_faces;
+		if (run_face_cache && all_deflections.size() > 1) {
+			TopExp::MapShapesAndAncestors(visible, TopAbs_EDGE, TopAbs_FACE, edge_faces);
+		}
+		auto borders_other_group = [&](const TopoDS_Face& fac, const std::pair<double,double>& key) {
+			if (edge_faces.IsEmpty()) return false;
+			for (TopExp_Explorer it(fac, TopAbs_EDGE); it.More(); it.Next()) {
+				const TopTools_ListOfShape& faces = edge_faces.FindFromKey(it.Current());
+				for (TopTools_ListOfShape::Iterator jt(faces); jt.More(); jt.Next()) {
+					if (deflections(TopoDS::Face(jt.Value())) != key) return true;
+				}
+			}
+			return false;
+		};
+
+		std::map<std::pair<double,double>, TopoDS_Compound> groups;
+		std::vector<std::pair<TopoDS_Face, uint64_t>> uncached;
+		std::set<const TopoDS_TShape*> seen;
+		face_cache_stats stats;
+		for (TopExp_Explorer it(visible, TopAbs_FACE); it.More(); it.Next()) {
+			const TopoDS_Face& fac = TopoDS::Face(it.Current());
+			std::pair<double,double> key = deflections(fac);
+			if (run_face_cache) {
+				/* copies placed by location share one triangulation */
+				if (!seen.insert(fac.TShape().get()).second) continue;
+				if (!borders_other_group(fac, key)) {
+					uint64_t hash = face_cache_key(fac, key.first, is_relative, key.second);
+					Handle(Poly_Triangulation) pt = find_cached_face(hash, stats);
+					if (!pt.IsNull()) {
+						BRep_Builder().UpdateFace(fac, pt);
+						continue;
+					}
+					stats.misses++;
+					uncached.push_back(std::make_pair(fac, hash));
+				}
+			}
+			BRep_Builder b;
+			if (groups.count(key) == 0) b.MakeCompound(groups[key]);
+			b.Add(groups[key], fac);
+		}
+		progress.running = "mesh";
+		int n_meshed = 0;
+		for (auto it = groups.begin(); it != groups.end(); it++) {
+			check_cancel();
+			report_progress((double)n_meshed++ / groups.size());
+			BRepMesh_IncrementalMesh(it->second, it->first.first, is_relative, it->first.second);
+		}
+		check_cancel();
+		for (int i = 0; i < uncached.size(); i++) {
+			TopLoc_Location location;
+			Handle(Poly_Triangulation) pt = BRep_Tool::Triangulation(uncached[i].first, location);
+			if (!pt.IsNull()) store_cached_face(uncached[i].second, pt);
+		}
+		if (run_face_cache) {
+			printf("face cache: %d hits (%d from disk), %d meshed\n", stats.hits, stats.disk_hits, stats.misses);
+		}
 
-		int offset = 0;
-		for (TopExp_Explorer it(shp, TopAbs_FACE); it.More(); it.Next()) {
+		mesh_builder mb(m);
+		soa3 local, points, tri_pts[3], normals;
+		std::vector<char> inside;
+		std::vector<double> dist;
+		std::vector<int> corners;
+		/* copies placed by location (patterns, imports) share one
+		 * triangulation; it can only go after its last copy is read */
+		std::map<const TopoDS_TShape*, int> uses_left;
+		if (run_low_memory) {
+			for (TopExp_Explorer it(visible, TopAbs_FACE); it.More(); it.Next()) uses_left[it.Current().TShape().get()]++;
+		}
+		for (TopExp_Explorer it(visible, TopAbs_FACE); it.More(); it.Next()) {
 			TopoDS_Face fac = TopoDS::Face(it.Current());
 			TopAbs_Orientation face_orientation = fac.Orientation();
 			TopLoc_Location location;
 			Handle(Poly_Triangulation) pt = BRep_Tool::Triangulation(fac, location);
 			if (pt.IsNull()) continue;
+			mb.begin_face();
 
 			const TColgp_Array1OfPnt& vertex_nodes = pt->Nodes();
 			const Poly_Array1OfTriangle& triangles = pt->Triangles();
 
-			for (int i = 0; i < vertex_nodes.Length(); i++) {
-				v3 point = gp_Pnt_to_v3(vertex_nodes(i+1).Transformed(location));
-				if (!vertex_map.count(point)) {
-					vertex_map[point] = m->vertices.size();
-					m->vertices.push_back(point);
-				} else {
-					n_duplicate_vertices++;
+			/* nodes are in face-local coordinates */
+			const int n_nodes = vertex_nodes.Length();
+			local.resize(n_nodes);
+			for (int i = 0; i < n_nodes; i++) {
+				const gp_Pnt& p = vertex_nodes(i+1);
+				local.x[i] = p.X();
+				local.y[i] = p.Y();
+				local.z[i] = p.Z();
+			}
+			double m[12];
+			trsf_matrix(location.Transformation(), m);
+			soa_transform(m, local, points);
+			for (int i = 0; i < n_nodes; i++) mb.vertex(points.get(i));
+
+			/* vertex i is inside cull volume j if inside[j*n_nodes + i] */
+			inside.assign(cull_volumes.size() * n_nodes, 1);
+			dist.resize(n_nodes);
+			for (int j = 0; j < cull_volumes.size(); j++) {
+				const cull_volume& vol = cull_volumes[j];
+				for (int k = 0; k < vol.planes.size(); k++) {
+					soa_plane_distances(points, vol.planes[k].p, vol.planes[k].n, dist.data());
+					for (int i = 0; i < n_nodes; i++) {
+						if (dist[i] > 0.0001) inside[j*n_nodes + i] = 0;
+					}
 				}
 			}
 
-			std::map<v3,int,v3_less> normal_map;
-
-			int n = pt->NbTriangles();
+			const int n = pt->NbTriangles();
+			corners.resize(n*3);
 			for (int i = 0; i < n; i++) {
 				Standard_Integer vni0, vni1, vni2;
 				triangles(i+1).Get(vni0, vni1, vni2);
+				if (face_orientation != TopAbs_Orientation::TopAbs_FORWARD) std::swap(vni0, vni2);
+				corners[i*3+0] = vni0-1;
+				corners[i*3+1] = vni1-1;
+				corners[i*3+2] = vni2-1;
+			}
+			for (int k = 0; k < 3; k++) {
+				tri_pts[k].resize(n);
+				for (int i = 0; i < n; i++) tri_pts[k].set(i, points.get(corners[i*3+k]));
+			}
+			soa_face_normals(tri_pts[0], tri_pts[1], tri_pts[2], normals);
 
-				const v3& p0 = gp_Pnt_to_v3(vertex_nodes(vni0));
-				const v3& p1 = gp_Pnt_to_v3(vertex_nodes(vni1));
-				const v3& p2 = gp_Pnt_to_v3(vertex_nodes(vni2));
-
-				bool do_cull = false;
-				for (int j = 0; j < cull_volumes.size(); j++) {
-					const cull_volume& vol = cull_volumes[j];
-					if (vol.is_inside(p0) && vol.is_inside(p1) && vol.is_inside(p2)) {
-						do_cull = true;
-						break;
-					}
-				}
-				if (do_cull) {
-					continue;
-				}
-
-				int vi0 = vertex_map[p0];
-				int vi1 = vertex_map[p1];
-				int vi2 = vertex_map[p2];
-
-				triangle tri;
-				bool flip_normal;
-				if (face_orientation == TopAbs_Orientation::TopAbs_FORWARD) {
-					tri.v0 = vi0;
-					tri.v1 = vi1;
-					tri.v2 = vi2;
-					flip_normal = false;
-				} else {
-					tri.v2 = vi0;
-					tri.v1 = vi1;
-					tri.v0 = vi2;
-					flip_normal = true;
-				}
-
-				const v3& normal = ((p1-p0).cross(p2-p0)).unit() * (flip_normal ? -1.0 : 1.0);
-
-				if (normal_map.count(normal) == 0) {
-					normal_map[normal] = m->normals.size();
-					m->normals.push_back(normal);
+			for (int i = 0; i < n; i++) {
+				const v3 normal = normals.get(i);
+				if (normal.x == 0 && normal.y == 0 && normal.z == 0) continue;
+				const int* c = &corners[i*3];
+				bool culled = false;
+				for (int j = 0; j < cull_volumes.size() && !culled; j++) {
+					const char* in = &inside[j*n_nodes];
+					culled = in[c[0]] && in[c[1]] && in[c[2]];
 				}
-
-				tri.n = normal_map[normal];
-
-				m->triangles.push_back(tri);
+				if (culled) continue;
+				mb.add_triangle(points.get(c[0]), points.get(c[1]), points.get(c[2]), normal);
 			}
 
-			offset += vertex_nodes.Length();
+			if (run_low_memory && --uses_left[fac.TShape().get()] == 0) {
+				pt.Nullify();
+				BRep_Builder().UpdateFace(fac, Handle(Poly_Triangulation)());
+			}
+		}
+		/* the polygons left on the edges */
+		if (run_low_memory) BRepTools::Clean(visible);
+
+		if (analytic_parts.size() > 0) {
+			scope_timer ST("tessellate analytic parts");
+			const int n_before = m->triangles.size();
+			for (int i = 0; i < analytic_parts.size(); i++) {
+				const analytic_part& part = analytic_parts[i];
+				part.n->tessellate_rec(mb, part.tx, part.linear_deflection, is_relative, part.angular_deflection);
+			}
+			printf("analytic: %d parts, %d triangles\n", (int)analytic_parts.size(), (int)m->triangles.size() - n_before);
 		}
+
+		printf("mesh: %d vertices, %d triangles\n", (int)m->vertices.size(), (int)m->triangles.size());
+
 		return m;
 	}
 
@@ -540,96 +4909,273 @@ struct node {
 		}
 	}
 
+	void write_mesh_outputs(mesh* mesh)
+	{
+		/* baked before simplifying, for the exact surface */
+		if (run_write_sdf) write_sdf(mesh, mkobj.name, atoi(run_write_sdf), job_limit());
+
+		if (run_decimate || run_decimate_error) {
+			struct mesh* decimated = decimate_mesh(
+				mesh,
+				run_decimate ? atoi(run_decimate) : 0,
+				run_decimate_error ? atof(run_decimate_error) : 0
+			);
+			if (run_low_memory) delete mesh;
+			mesh = decimated;
+		}
+
+		if (run_write_obj) {
+			write_obj(mesh, run_write_obj, mkobj.name);
+
+			/* each level halves the previous one */
+			const int n_lods = run_lods ? atoi(run_lods) : 0;
+			const struct mesh* lod = mesh;
+			for (int i = 1; i <= n_lods; i++) {
+				const struct mesh* next = decimate_mesh(lod, lod->triangles.size()/2, 0);
+				if (run_low_memory && lod != mesh) delete lod;
+				lod = next;
+				char suffix[32];
+				snprintf(suffix, sizeof suffix, ".lod%d", i);
+				char* prefix = str_concat(run_write_obj, suffix);
+				write_obj(lod, prefix, mkobj.name);
+				free(prefix);
+			}
+			if (run_low_memory && lod != mesh) delete lod;
+		}
+
+		if (run_write_meshlets) write_meshlets(mesh, run_write_meshlets, job_limit());
+
+		if (run_write_glb) {
+			/* kept until the scene is written in exit_main() */
+			glb_object obj;
+			obj.name = mkobj.name;
+			obj.instance_marker = mkobj.instance_marker;
+			obj.mesh = mesh;
+			glb_objects.push_back(obj);
+		} else if (run_low_memory) {
+			delete mesh;
+		}
+	}
+
+	/* a --mesh-cache hit; simplifying needs a mesh of its own, otherwise
+	 * the exporters read the mapping, which --write-glb keeps until exit */
+	void write_cached_mesh_outputs(mapped_mesh* mm)
+	{
+		if (run_decimate || run_decimate_error || (run_write_obj && run_lods)) {
+			mesh* m = copy_mesh(mm->view);
+			unmap_cached_mesh(mm);
+			write_mesh_outputs(m);
+			return;
+		}
+
+		if (run_write_sdf) write_sdf(mm->view, mkobj.name, atoi(run_write_sdf), job_limit());
+		if (run_write_obj) write_obj(mm->view, run_write_obj, mkobj.name);
+		if (run_write_meshlets) write_meshlets(mm->view, run_write_meshlets, job_limit());
+
+		if (run_write_glb) {
+			glb_object obj;
+			obj.name = mkobj.name;
+			obj.instance_marker = mkobj.instance_marker;
+			obj.mesh = mm->view;
+			glb_objects.push_back(obj);
+		} else {
+			unmap_cached_mesh(mm);
+		}
+	}
+
+	bool needs_mesh()
+	{
+		return run_write_obj || run_write_glb || run_write_meshlets || run_write_sdf;
+	}
+
+	/* --write-brep needs the shape, and meshes it without the analytic
+	 * shortcut, so it bypasses the cache */
+	bool uses_mesh_cache()
+	{
+		return run_mesh_cache && needs_mesh() && !run_write_brep;
+	}
+
+	bool needs_shape()
+	{
+		return needs_mesh() || run_write_brep;
+	}
+
+	void write_brep(const TopoDS_Shape& shp)
+	{
+		scope_timer ST("write brep");
+		char* filename = str_concat(run_write_brep, ".brep");
+		if (!BinTools::Write(shp, filename)) {
+			fprintf(stderr, "%s: write failed\n", filename);
+			exit(EXIT_FAILURE);
+		}
+		free(filename);
+	}
+
+	bool is_selected()
+	{
+		assert(type == MKOBJ);
+		if (run_only.size() == 0) return true;
+		for (int i = 0; i < run_only.size(); i++) {
+			if (strcmp(run_only[i], mkobj.name) == 0) return true;
+		}
+		return false;
+	}
+
+	/* nothing refers to the tree once its mkobj() is done, except a
+	 * --pipeline job, which then releases it */
+	void release_tree(bool handed_off = false)
+	{
+		assert(tree_root == this);
+		tree_root = NULL;
+		if (run_low_memory && !handed_off) delete this;
+	}
+
+	void mesh_and_write(TopoDS_Shape& shp)
+	{
+		mesh* m = build_mesh(shp, mkobj.linear_deflection, mkobj.is_relative, mkobj.angular_deflection);
+		if (uses_mesh_cache()) store_cached_mesh(mesh_cache_key(), m);
+		progress.done = progress.total;
+		report_progress();
+		if (run_low_memory) shp.Nullify();
+		write_mesh_outputs(m);
+	}
+
 	void leave_mkobj()
 	{
 		assert(type == MKOBJ);
 
+		if (is_writing_ir()) {
+			const uint64_t hash = ir_hash();
+			record_ir([this, hash](ir_writer& w) {
+				if (w.text) {
+					w.out += str_printf("# %016llx\n", (unsigned long long)hash);
+				} else {
+					w.u8(IR_OBJECT);
+				}
+				write_ir(w);
+			});
+		}
+
+		if (!is_selected()) {
+			release_tree();
+			return;
+		}
+
 		if (run_dump) {
 			dump_rec();
+			printf("hash: %016llx\n", (unsigned long long)ir_hash());
 			dump_markers();
 		}
 
-		TopoDS_Shape shp;
-		{
-			scope_timer ST("build shape");
-			shp = build_shape_rec();
+		/* markers are known once the program has run, so a markers-only
+		 * (or IR-only) run never needs the shapes */
+		if ((run_markers_out || is_writing_ir()) && !needs_shape()) {
+			release_tree();
+			return;
 		}
 
-		if (run_write_obj) {
-			mesh* mesh = build_mesh(shp, mkobj.linear_deflection, mkobj.is_relative, mkobj.angular_deflection);
-
-			auto str_concat = [](const char* s1, const char* s2) -> char* {
-				char* result = (char*) malloc(strlen(s1)+strlen(s2)+1);
-				assert(result != NULL);
-				strcpy(result, s1);
-				strcat(result, s2);
-				return result;
-			};
-
-			auto fopen_for_write = [](char* path) -> FILE* {
-				FILE* f = fopen(path, "wb");
-				if (f == NULL) {
-					fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
-					exit(EXIT_FAILURE);
-				}
-				return f;
-			};
+		mapped_mesh* cached = (!run_preview && uses_mesh_cache()) ? map_cached_mesh(mesh_cache_key()) : NULL;
 
-			char* filename_obj = str_concat(run_write_obj, ".obj");
-			char* filename_mtl = str_concat(run_write_obj, ".mtl");
+		if (run_preview) {
+			write_mesh_outputs(build_preview_mesh());
+		} else if (cached) {
+			printf("mesh cache: %d vertices, %d triangles\n", cached->view.n_vertices, cached->view.n_triangles);
+			/* objects queued before this one are written first */
+			writer_pipeline.drain();
+			write_cached_mesh_outputs(cached);
+		} else {
+			progress = eval_progress();
+			progress.total = count_build_nodes() + (needs_mesh() ? 1 : 0);
+			progress.running = label();
+
+			/* parts that never meet a boolean skip BRep entirely when
+			 * only a mesh is wanted */
+			if (needs_mesh() && !run_write_brep) {
+				collect_analytic(gp_Trsf(), mkobj.linear_deflection, mkobj.angular_deflection);
+				TopoDS_Compound empty;
+				BRep_Builder b;
+				b.MakeCompound(empty);
+				for (int i = 0; i < analytic_parts.size(); i++) prebuilt_shapes[analytic_parts[i].n] = empty;
+			}
 
-			FILE* file_obj = fopen_for_write(filename_obj);
-			FILE* file_mtl = fopen_for_write(filename_mtl);
+			/* imported shapes are cached and shared between objects; the
+			 * writer may still be meshing (or, with --low-memory,
+			 * cleaning) one that this object reads */
+			if (run_pipeline && uses_import()) writer_pipeline.drain();
 
-			/* seems Y is up in Wavefront OBJ, so Blender actually
-			 * swizzles the input coordinates; guess I have to
-			 * unswizzle them then! */
-			auto wavefront_obj_v3_swizzle = [](const v3& v) -> v3 {
-				return v3(v.x, v.z, -v.y);
-			};
+			if (run_isolate) build_isolated();
 
-			/* write .obj */
-			fprintf(file_obj, "mtllib %s\n", filename_mtl);
-			fprintf(file_obj, "o %s\n", tree_root->mkobj.name);
-			for (auto it = mesh->vertices.begin(); it != mesh->vertices.end(); it++) {
-				const v3 p = wavefront_obj_v3_swizzle(*it);
-				fprintf(file_obj, "v %.6f %.6f %.6f\n", p.x, p.y, p.z);
+			TopoDS_Shape shp;
+			{
+				scope_timer ST("build shape");
+				shp = build_shape_rec();
 			}
-			for (auto it = mesh->normals.begin(); it != mesh->normals.end(); it++) {
-				const v3 n = wavefront_obj_v3_swizzle(*it);
-				fprintf(file_obj, "vn %.6f %.6f %.6f\n", n.x, n.y, n.z);
-			}
-			fprintf(file_obj, "usemtl Mat\n");
-			fprintf(file_obj, "s off\n");
-			for (auto it = mesh->triangles.begin(); it != mesh->triangles.end(); it++) {
-				const triangle t = (*it);
-				fprintf(file_obj, "f %d//%d %d//%d %d//%d\n", t.v0+1, t.n+1, t.v1+1, t.n+1, t.v2+1, t.n+1);
+			prebuilt_shapes.clear();
+
+			if (run_unify_booleans) {
+				printf("unified boolean results: %d -> %d faces\n", unify_stats.faces_before, unify_stats.faces_after);
+				unify_stats = unify_counts();
 			}
 
-			/* write .mtl */
-			fprintf(file_mtl, "newmtl Mat\n");
-			fprintf(file_mtl, "Ns 0\n");
-			fprintf(file_mtl, "Ka 0.000000 0.000000 0.000000\n");
-			fprintf(file_mtl, "Kd 0.8 0.8 0.8\n");
-			fprintf(file_mtl, "Ks 0.8 0.8 0.8\n");
-			fprintf(file_mtl, "d 1\n");
-			fprintf(file_mtl, "illum 2\n");
+			if (run_unify) {
+				scope_timer ST("unify faces");
+				const int before = count_faces(shp);
+				shp = unify_same_domain(shp);
+				printf("unified: %d -> %d faces\n", before, count_faces(shp));
+			}
 
-			fclose(file_mtl);
-			fclose(file_obj);
+			if (run_write_brep) write_brep(shp);
+
+			bool handed_off = false;
+			if (needs_mesh() && run_pipeline) {
+				mesh_job* job = new mesh_job;
+				job->root = this;
+				job->shp = shp;
+				job->analytic_parts.swap(analytic_parts);
+				job->surface_resolutions.swap(surface_resolutions);
+				job->cull_volumes = cull_volumes;
+				shp.Nullify();
+				writer_pipeline.push(job);
+				handed_off = true;
+			} else if (needs_mesh()) {
+				mesh_and_write(shp);
+			}
+			surface_resolutions.clear();
+			analytic_parts.clear();
+			release_tree(handed_off);
+			return;
 		}
 
-		tree_root = NULL;
+		release_tree();
 	}
 
 	void leave() {
 		switch (type) {
 		case MKOBJ: leave_mkobj(); break;
+		case MIRROR:
+		case SYMMETRIC:
+		case PATTERN_LINEAR:
+		case PATTERN_POLAR: replicate_stack.pop_back(); break;
 		default: break;
 		}
 	}
 };
 
+static void run_mesh_job(mesh_job* job)
+{
+	analytic_parts.swap(job->analytic_parts);
+	surface_resolutions.swap(job->surface_resolutions);
+	cull_volumes.swap(job->cull_volumes);
+
+	job->root->mesh_and_write(job->shp);
+	if (run_low_memory) delete job->root;
+
+	analytic_parts.clear();
+	surface_resolutions.clear();
+	cull_volumes.clear();
+	delete job;
+}
+
 static node* node_stack_top()
 {
 	assert(node_stack.size() > 0);
@@ -677,6 +5223,7 @@ void _grp_mkobj(const char* name, double linear_deflection, bool is_relative, do
 	tree_root->mkobj.linear_deflection = linear_deflection;
 	tree_root->mkobj.is_relative = is_relative;
 	tree_root->mkobj.angular_deflection = angular_deflection;
+	tree_root->mkobj.instance_marker = NULL;
 	node_stack.push_back(tree_root);
 }
 
@@ -732,6 +5279,98 @@ void _grp_fillet(double radius)
 	enter_node(n);
 }
 
+void _grp_shell(double thickness, const v3& open0, const v3& open1, const v3& open2, const v3& open3, const v3& open4, const v3& open5)
+{
+	assert(thickness > 0);
+	node* n = new node(SHELL);
+	n->shell.thickness = thickness;
+	n->shell.n_open = 0;
+	const v3* open[] = { &open0, &open1, &open2, &open3, &open4, &open5 };
+	for (int i = 0; i < 6; i++) {
+		if (open[i]->length() > 0) n->shell.open[n->shell.n_open++] = *open[i];
+	}
+	enter_node(n);
+}
+
+void _grp_offset(double distance)
+{
+	node* n = new node(OFFSET);
+	n->offset.distance = distance;
+	enter_node(n);
+}
+
+void _grp_resolution(double linear_deflection, double angular_deflection)
+{
+	node* n = new node(RESOLUTION);
+	n->resolution.linear_deflection = linear_deflection;
+	n->resolution.angular_deflection = angular_deflection;
+	enter_node(n);
+}
+
+static void enter_replicate_node(node* n)
+{
+	/* copies in world space: W * copy * W^-1 */
+	gp_Trsf w = get_current_transform();
+	std::vector<gp_Trsf> copies = n->get_copies();
+	for (int i = 0; i < copies.size(); i++) copies[i] = w * copies[i] * w.Inverted();
+	enter_node(n);
+	replicate_stack.push_back(copies);
+}
+
+void _grp_mirror(const v3& plane_normal)
+{
+	assert(plane_normal.length() > 0);
+	node* n = new node(MIRROR);
+	n->mirror.n = plane_normal;
+	enter_replicate_node(n);
+}
+
+void _grp_symmetric(int count, const v3& axis)
+{
+	assert(count >= 1);
+	assert(axis.length() > 0);
+	node* n = new node(SYMMETRIC);
+	n->symmetric.n = count;
+	n->symmetric.axis = axis;
+	enter_replicate_node(n);
+}
+
+void _grp_pattern_linear(int count, const v3& step)
+{
+	assert(count >= 1);
+	node* n = new node(PATTERN_LINEAR);
+	n->pattern_linear.count = count;
+	n->pattern_linear.step = step;
+	enter_replicate_node(n);
+}
+
+void _grp_pattern_polar(int count, const v3& axis, double degrees)
+{
+	assert(count >= 1);
+	assert(axis.length() > 0);
+	node* n = new node(PATTERN_POLAR);
+	n->pattern_polar.count = count;
+	n->pattern_polar.axis = axis;
+	n->pattern_polar.degrees = degrees;
+	enter_replicate_node(n);
+}
+
+/* every placement of a marker/cull volume made at tx, counting the
+ * copies of the mirror()/symmetric()/pattern_*() bodies it is inside */
+static std::vector<gp_Trsf> replicated_transforms(const gp_Trsf& tx)
+{
+	/* innermost first: a copy of a copy is the inner copy placed by the
+	 * outer one */
+	std::vector<gp_Trsf> r(1, tx);
+	for (int i = replicate_stack.size()-1; i >= 0; i--) {
+		const int n = r.size();
+		for (int j = 0; j < replicate_stack[i].size(); j++) {
+			for (int k = 0; k < n; k++) r.push_back(replicate_stack[i][j] * r[k]);
+		}
+	}
+	return r;
+}
+
 void _grp_face()
 {
 	enter_node(new node(FACE));
@@ -744,6 +5383,16 @@ void _grp_prism(const v3& v)
 	enter_node(n);
 }
 
+void _grp_revolve(const v3& axis, double degrees)
+{
+	assert(axis.length() > 0);
+	assert(degrees != 0 && fabs(degrees) <= 360);
+	node* n = new node(REVOLVE);
+	n->revolve.axis = axis;
+	n->revolve.degrees = degrees;
+	enter_node(n);
+}
+
 void move_to(const v3& p)
 {
 	node* n = new node(MOVE_TO);
@@ -776,6 +5425,17 @@ void circle_arc_to(const v3& point_on_circle, const v3& end_point)
 	push_node(n);
 }
 
+void circle(const v3& center, double radius, const v3& normal)
+{
+	assert(radius > 0);
+	assert(normal.length() > 0);
+	node* n = new node(CIRCLE);
+	n->circle.center = center;
+	n->circle.radius = radius;
+	n->circle.normal = normal;
+	push_node(n);
+}
+
 void box(const v3& size)
 {
 	node* n = new node(BOX);
@@ -788,9 +5448,33 @@ void box(double sx, double sy, double sz)
 	box(v3(sx,sy,sz));
 }
 
-void cullbox(const v3& size)
+static void add_cull_volume(const cull_volume& vol)
+{
+	record_ir([&vol](ir_writer& w) {
+		w.begin("cull", IR_CULL);
+		w.count(vol.planes.size());
+		for (int i = 0; i < vol.planes.size(); i++) {
+			w.vec(vol.planes[i].p);
+			w.vec(vol.planes[i].n);
+		}
+		w.end_line();
+	});
+	cull_volumes.push_back(vol);
+}
+
+static void add_marker(const char* name, const gp_Trsf& tx)
+{
+	record_ir([name, &tx](ir_writer& w) {
+		w.begin("marker", IR_MARKER);
+		w.str(name);
+		w.trsf(tx);
+		w.end_line();
+	});
+	markers[name].push_back(tx);
+}
+
+static void add_cullbox(const v3& size, const gp_Trsf& tx)
 {
-	gp_Trsf tx = get_current_transform();
 	v3 vertices[8];
 	int i = 0;
 	for (int z = 0; z < 2; z++) {
@@ -819,7 +5503,9 @@ void cullbox(const v3& size)
 				ps[i] = vertices[vertex_index];
 			}
 
-			const v3& normal = ((ps[1]-ps[0]).cross(ps[2]-ps[0])).unit();
+			v3 normal = ((ps[1]-ps[0]).cross(ps[2]-ps[0])).unit();
+			/* a mirrored box turns inside out */
+			if (tx.IsNegative()) normal = -normal;
 
 			cull_plane pla;
 			pla.p = ps[0];
@@ -828,7 +5514,13 @@ void cullbox(const v3& size)
 		}
 	}
 
-	cull_volumes.push_back(vol);
+	add_cull_volume(vol);
+}
+
+void cullbox(const v3& size)
+{
+	std::vector<gp_Trsf> txs = replicated_transforms(get_current_transform());
+	for (int i = 0; i < txs.size(); i++) add_cullbox(size, txs[i]);
 }
 
 void cullbox(double sx, double sy, double sz)
@@ -836,9 +5528,56 @@ void cullbox(double sx, double sy, double sz)
 	cullbox(v3(sx,sy,sz));
 }
 
+void instance_at(const char* marker_name)
+{
+	if (tree_root == NULL) {
+		assert(!"instance_at() must be inside mkobj()");
+	}
+	tree_root->mkobj.instance_marker = marker_name;
+}
+
 void marker(const char* name)
 {
-	markers[name].push_back(get_current_transform());
+	std::vector<gp_Trsf> txs = replicated_transforms(get_current_transform());
+	for (int i = 0; i < txs.size(); i++) add_marker(name, txs[i]);
+}
+
+void load_ir(const char* path)
+{
+	if (tree_root != NULL) {
+		assert(!"load_ir() cannot be inside mkobj()");
+	}
+
+	ir_reader r(path);
+	while (!r.at_end()) {
+		switch (r.begin(ir_event_name)) {
+		case IR_OBJECT: {
+			const int type = r.text ? MKOBJ : r.begin(node_type_name);
+			if (type != MKOBJ) r.fail("expected mkobj");
+			tree_root = node::read_ir(r, type);
+			tree_root->leave_mkobj();
+			} break;
+		case IR_MARKER: {
+			const char* name;
+			r.str(name);
+			if (name == NULL) r.fail("marker without a name");
+			add_marker(name, r.trsf());
+			} break;
+		case IR_CULL: {
+			cull_volume vol;
+			const int n = r.count();
+			for (int i = 0; i < n; i++) {
+				cull_plane pla;
+				r.vec(pla.p);
+				r.vec(pla.n);
+				vol.planes.push_back(pla);
+			}
+			add_cull_volume(vol);
+			} break;
+		default:
+			r.fail("unknown record");
+		}
+	}
 }
 
 void wedge(double sx, double sy, double sz, double ltx)
@@ -873,6 +5612,207 @@ void cone(double r0, double r1, double height)
 	push_node(n);
 }
 
+void set_progress_callback(progress_callback cb, void* usr)
+{
+	progress_cb = cb;
+	progress_usr = usr;
+}
+
+void cancel_evaluation()
+{
+	cancel_requested = CANCEL_REQUESTED;
+}
+
+void import_brep(const char* path)
+{
+	node* n = new node(IMPORT_BREP);
+	n->import_brep.path = path;
+	push_node(n);
+}
+
+
+/* str as a quoted JSON string */
+static std::string json_quote(const char* str)
+{
+	std::string r = "\"";
+	for (const char* c = str; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			r += '\\';
+			r += *c;
+		} else if ((unsigned char)*c < 0x20) {
+			r += str_printf("\\u%04x", *c);
+		} else {
+			r += *c;
+		}
+	}
+	return r + "\"";
+}
+
+static void write_markers_json(const char* path)
+{
+	FILE* f = fopen_for_write(path);
+
+	/* each transform is a row-major 3x4 matrix, like --dump prints them */
+	fprintf(f, "{\n");
+	for (auto it = markers.begin(); it != markers.end(); it++) {
+		fprintf(f, "\t%s: [\n", json_quote(it->first).c_str());
+		const std::vector<gp_Trsf>& ms = it->second;
+		for (int i = 0; i < ms.size(); i++) {
+			fprintf(f, "\t\t[");
+			for (int row = 1; row <= 3; row++) {
+				for (int col = 1; col <= 4; col++) {
+					fprintf(f, "%s%.9g", (row == 1 && col == 1) ? "" : ", ", ms[i].Value(row, col));
+				}
+			}
+			fprintf(f, "]%s\n", i+1 < ms.size() ? "," : "");
+		}
+		auto next = it;
+		next++;
+		fprintf(f, "\t]%s\n", next != markers.end() ? "," : "");
+	}
+	fprintf(f, "}\n");
+
+	fclose(f);
+}
+
+/* binary glTF 2.0 scene of every object built in this run. Each mesh is
+ * stored once; objects with instance_at() get one node per marker
+ * transform referencing it. Meshes carry no normals, which glTF readers
+ * must treat as flat shading, like the "s off" OBJs. A root node turns
+ * our Z-up into glTF's Y-up. */
+static void write_glb(const char* path_prefix)
+{
+	std::string json;
+	std::vector<unsigned char> bin;
+	auto append = [](std::string& str, const char* fmt, ...) {
+		char buf[512];
+		va_list ap;
+		va_start(ap, fmt);
+		vsnprintf(buf, sizeof buf, fmt, ap);
+		va_end(ap);
+		str += buf;
+	};
+	auto append_bin = [&bin](const void* data, size_t n) {
+		const unsigned char* p = (const unsigned char*)data;
+		bin.insert(bin.end(), p, p+n);
+	};
+	auto append_matrix = [&](std::string& str, const gp_Trsf& tx) {
+		str += "\"matrix\":[";
+		for (int col = 1; col <= 4; col++) {
+			for (int row = 1; row <= 4; row++) {
+				double v = row == 4 ? (col == 4 ? 1 : 0) : tx.Value(row, col);
+				append(str, "%s%.9g", (row == 1 && col == 1) ? "" : ",", v);
+			}
+		}
+		str += "]";
+	};
+
+	std::string nodes, meshes, accessors, views;
+	std::string root_children;
+	int n_nodes = 1;
+	int n_meshes = 0;
+	for (int oi = 0; oi < glb_objects.size(); oi++) {
+		const glb_object& obj = glb_objects[oi];
+		const mesh_view& m = obj.mesh;
+		const std::string name = json_quote(obj.name);
+
+		/* glTF has no empty buffer views or accessors */
+		if (m.n_triangles == 0) {
+			printf("%s: empty mesh, left out\n", obj.name);
+			continue;
+		}
+		const int i = n_meshes++;
+
+		/* positions; rounding to float is monotonic, so the float
+		 * bounds are the rounded double bounds */
+		soa3 pts;
+		soa_load(m.vertices, m.n_vertices, pts);
+		v3 mn, mx;
+		soa_bounds(pts, mn, mx);
+		for (int k = 0; k < 3; k++) {
+			mn.s[k] = (float)mn.s[k];
+			mx.s[k] = (float)mx.s[k];
+		}
+		const size_t pos_offset = bin.size();
+		for (int j = 0; j < m.n_vertices; j++) {
+			float p[3];
+			for (int k = 0; k < 3; k++) p[k] = m.vertices[j].s[k];
+			append_bin(p, sizeof p);
+		}
+		const size_t idx_offset = bin.size();
+		for (int j = 0; j < m.n_triangles; j++) {
+			const triangle& t = m.triangles[j];
+			uint32_t idx[3] = { (uint32_t)t.v0, (uint32_t)t.v1, (uint32_t)t.v2 };
+			append_bin(idx, sizeof idx);
+		}
+
+		append(views, "%s{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34962}", i ? "," : "", pos_offset, idx_offset - pos_offset);
+		append(views, ",{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34963}", idx_offset, bin.size() - idx_offset);
+		append(accessors, "%s{\"bufferView\":%d,\"componentType\":5126,\"count\":%d,\"type\":\"VEC3\"", i ? "," : "", i*2, m.n_vertices);
+		append(accessors, ",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]", mn.x, mn.y, mn.z, mx.x, mx.y, mx.z);
+		append(accessors, "},{\"bufferView\":%d,\"componentType\":5125,\"count\":%d,\"type\":\"SCALAR\"}", i*2+1, m.n_triangles*3);
+		meshes += std::string(i ? "," : "") + "{\"name\":" + name;
+		append(meshes, ",\"primitives\":[{\"attributes\":{\"POSITION\":%d},\"indices\":%d,\"mode\":4}]}", i*2, i*2+1);
+
+		std::vector<gp_Trsf> instances;
+		if (obj.instance_marker) {
+			for (auto it = markers.begin(); it != markers.end(); it++) {
+				if (strcmp(it->first, obj.instance_marker) == 0) instances = it->second;
+			}
+			if (instances.size() == 0) {
+				fprintf(stderr, "warning: no markers named \"%s\" to instance \"%s\" at\n", obj.instance_marker, obj.name);
+			}
+		} else {
+			instances.push_back(gp_Trsf());
+		}
+		for (int j = 0; j < instances.size(); j++) {
+			nodes += ",{\"name\":" + name;
+			append(nodes, ",\"mesh\":%d,", i);
+			append_matrix(nodes, instances[j]);
+			nodes += "}";
+			append(root_children, "%s%d", n_nodes > 1 ? "," : "", n_nodes);
+			n_nodes++;
+		}
+	}
+
+	json += "{\"asset\":{\"version\":\"2.0\",\"generator\":\"cg\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],";
+	json += "\"nodes\":[{\"name\":\"root\",\"matrix\":[1,0,0,0,0,0,-1,0,0,1,0,0,0,0,0,1]";
+	if (n_nodes > 1) json += ",\"children\":[" + root_children + "]";
+	json += "}" + nodes + "],";
+	if (n_meshes > 0) {
+		json += "\"meshes\":[" + meshes + "],";
+		json += "\"accessors\":[" + accessors + "],";
+		json += "\"bufferViews\":[" + views + "],";
+		append(json, "\"buffers\":[{\"byteLength\":%zu}],", bin.size());
+	}
+	json.back() = '}'; // was the last ','
+
+	while (json.size() % 4) json += ' ';
+	while (bin.size() % 4) bin.push_back(0);
+
+	auto put_u32 = [](FILE* f, uint32_t v) {
+		unsigned char b[4] = { (unsigned char)v, (unsigned char)(v>>8), (unsigned char)(v>>16), (unsigned char)(v>>24) };
+		fwrite(b, 1, 4, f);
+	};
+
+	char* filename = str_concat(path_prefix, ".glb");
+	FILE* f = fopen_for_write(filename);
+	put_u32(f, 0x46546C67); // "glTF"
+	put_u32(f, 2);
+	put_u32(f, 12 + 8 + json.size() + (bin.size() ? 8 + bin.size() : 0));
+	put_u32(f, json.size());
+	put_u32(f, 0x4E4F534A); // "JSON"
+	fwrite(json.data(), 1, json.size(), f);
+	if (bin.size()) {
+		put_u32(f, bin.size());
+		put_u32(f, 0x004E4942); // "BIN\0"
+		fwrite(bin.data(), 1, bin.size(), f);
+	}
+	fclose(f);
+	free(filename);
+
+	printf("wrote %s: %d meshes, %d instances\n", path_prefix, n_meshes, n_nodes-1);
+}
 
 int _HX_BEGIN = 0;
 void _grp0()
@@ -891,17 +5831,66 @@ int _grp1()
 	}
 }
 
+static void make_cache_dir(const char* path)
+{
+	if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "could not create %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
 void init_main(int argc, char** argv)
 {
 	if (argc < 2) {
 		fprintf(stderr, "usage: %s <opts...>\n", argv[0]);
 		fprintf(stderr, "  --write-obj <name>   writes Wavefront OBJ to <name>.obj and <name>.mtl\n");
+		fprintf(stderr, "  --write-glb <name>   writes all objects as a binary glTF scene to <name>.glb;\n");
+		fprintf(stderr, "                       instance_at() objects are placed at their markers\n");
+		fprintf(stderr, "  --write-meshlets <name> writes the mesh split into meshlets (clusters of up\n");
+		fprintf(stderr, "                       to 64 vertices and 124 triangles) with bounding spheres\n");
+		fprintf(stderr, "                       and normal cones to <name>.meshlets, on --jobs threads\n");
+		fprintf(stderr, "  --write-sdf <res>    writes a signed distance grid of each object's mesh with\n");
+		fprintf(stderr, "                       <res> voxels along its longest side to <object>.sdf\n");
+		fprintf(stderr, "  --write-brep <name>  writes the shape in binary BRep format to <name>.brep,\n");
+		fprintf(stderr, "                       for import_brep() in other programs\n");
+		fprintf(stderr, "  --write-ir <name>    writes the recorded node trees, markers and cull volumes\n");
+		fprintf(stderr, "                       to <name>.cgir, for load_ir() and cg-eval\n");
+		fprintf(stderr, "  --write-ir-text <name> same, as text to <name>.cgir.txt\n");
 		fprintf(stderr, "  --dump               dumps info to stdout\n");
+		fprintf(stderr, "  --preview            fast approximate (voxel) evaluation instead of BRep\n");
+		fprintf(stderr, "  --preview-res <n>    voxels along the longest axis in --preview (default 128)\n");
+		fprintf(stderr, "  --only <name>        only evaluate mkobj(<name>); may be repeated\n");
+		fprintf(stderr, "  --markers-out <path> writes marker transforms as JSON; without --write-obj\n");
+		fprintf(stderr, "                       no shapes are built\n");
+		fprintf(stderr, "  --decimate <n>       simplify meshes down to <n> triangles\n");
+		fprintf(stderr, "  --decimate-error <e> don't merge vertices whose RMS distance to the planes of the\n");
+		fprintf(stderr, "                       triangles they replace (area-weighted) would exceed <e>\n");
+		fprintf(stderr, "  --lods <n>           also writes <name>.lod1..<n>.obj, halving triangles each level\n");
+		fprintf(stderr, "  --isolate            builds each boolean, fillet and offset in a forked worker\n");
+		fprintf(stderr, "                       process, innermost first\n");
+		fprintf(stderr, "  --jobs <n>           max concurrent workers (default: number of cores)\n");
+		fprintf(stderr, "  --budget <seconds>   kills and skips a worker running longer than this\n");
+		fprintf(stderr, "  --unify              merges same-domain faces before meshing\n");
+		fprintf(stderr, "  --unify-booleans     merges same-domain faces after every cut/fuse/common\n");
+		fprintf(stderr, "  --tile-booleans <n>  does a cut/common with more than <n> tools in tiles of\n");
+		fprintf(stderr, "                       about <n> tools each, on --jobs threads, and glues the\n");
+		fprintf(stderr, "                       pieces together\n");
+		fprintf(stderr, "  --progress           prints build progress to stderr\n");
+		fprintf(stderr, "  --pipeline           meshes and writes each object on a background thread while\n");
+		fprintf(stderr, "                       the next one builds\n");
+		fprintf(stderr, "  --low-memory         keeps no boolean history and frees shapes, triangulations,\n");
+		fprintf(stderr, "                       meshes and trees as soon as they are used\n");
+		fprintf(stderr, "  --deadline <seconds> stops the run (like ^C) once it has taken this long\n");
+		fprintf(stderr, "  --face-cache <dir>   keeps face triangulations in <dir> and reuses them for\n");
+		fprintf(stderr, "                       unchanged faces, here and in later runs\n");
+		fprintf(stderr, "  --mesh-cache <dir>   keeps object meshes in <dir>; an unchanged object is\n");
+		fprintf(stderr, "                       exported from there without being built\n");
 		exit(EXIT_FAILURE);
 	}
 
 	char* store_for = NULL;
 	char** store_arg = NULL;
+	char* store_only = NULL;
 
 	for (int i = 1; i < argc; i++) {
 		char* arg = argv[i];
@@ -911,14 +5900,83 @@ void init_main(int argc, char** argv)
 				exit(EXIT_FAILURE);
 			}
 			*store_arg = arg;
+			if (store_arg == &store_only) run_only.push_back(arg);
 			store_for = NULL;
 			store_arg = NULL;
 		} else {
 			if (strcmp(arg, "--write-obj") == 0) {
 				store_for = arg;
 				store_arg = &run_write_obj;
+			} else if (strcmp(arg, "--write-glb") == 0) {
+				store_for = arg;
+				store_arg = &run_write_glb;
+			} else if (strcmp(arg, "--write-meshlets") == 0) {
+				store_for = arg;
+				store_arg = &run_write_meshlets;
+			} else if (strcmp(arg, "--write-sdf") == 0) {
+				store_for = arg;
+				store_arg = &run_write_sdf;
+			} else if (strcmp(arg, "--write-brep") == 0) {
+				store_for = arg;
+				store_arg = &run_write_brep;
+			} else if (strcmp(arg, "--write-ir") == 0) {
+				store_for = arg;
+				store_arg = &run_write_ir;
+			} else if (strcmp(arg, "--write-ir-text") == 0) {
+				store_for = arg;
+				store_arg = &run_write_ir_text;
 			} else if (strcmp(arg, "--dump") == 0) {
 				run_dump = true;
+			} else if (strcmp(arg, "--preview") == 0) {
+				run_preview = true;
+			} else if (strcmp(arg, "--preview-res") == 0) {
+				store_for = arg;
+				store_arg = &run_preview_res;
+			} else if (strcmp(arg, "--only") == 0) {
+				store_for = arg;
+				store_arg = &store_only;
+			} else if (strcmp(arg, "--markers-out") == 0) {
+				store_for = arg;
+				store_arg = &run_markers_out;
+			} else if (strcmp(arg, "--decimate") == 0) {
+				store_for = arg;
+				store_arg = &run_decimate;
+			} else if (strcmp(arg, "--decimate-error") == 0) {
+				store_for = arg;
+				store_arg = &run_decimate_error;
+			} else if (strcmp(arg, "--lods") == 0) {
+				store_for = arg;
+				store_arg = &run_lods;
+			} else if (strcmp(arg, "--isolate") == 0) {
+				run_isolate = true;
+			} else if (strcmp(arg, "--unify") == 0) {
+				run_unify = true;
+			} else if (strcmp(arg, "--unify-booleans") == 0) {
+				run_unify_booleans = true;
+			} else if (strcmp(arg, "--tile-booleans") == 0) {
+				store_for = arg;
+				store_arg = &run_tile_booleans;
+			} else if (strcmp(arg, "--jobs") == 0) {
+				store_for = arg;
+				store_arg = &run_jobs;
+			} else if (strcmp(arg, "--budget") == 0) {
+				store_for = arg;
+				store_arg = &run_budget;
+			} else if (strcmp(arg, "--deadline") == 0) {
+				store_for = arg;
+				store_arg = &run_deadline;
+			} else if (strcmp(arg, "--progress") == 0) {
+				run_progress = true;
+			} else if (strcmp(arg, "--low-memory") == 0) {
+				run_low_memory = true;
+			} else if (strcmp(arg, "--pipeline") == 0) {
+				run_pipeline = true;
+			} else if (strcmp(arg, "--face-cache") == 0) {
+				store_for = arg;
+				store_arg = &run_face_cache;
+			} else if (strcmp(arg, "--mesh-cache") == 0) {
+				store_for = arg;
+				store_arg = &run_mesh_cache;
 			} else {
 				fprintf(stderr, "invalid arg: %s\n", arg);
 				exit(EXIT_FAILURE);
@@ -930,4 +5988,46 @@ void init_main(int argc, char** argv)
 		fprintf(stderr, "missing argument for %s\n", store_for);
 		exit(EXIT_FAILURE);
 	}
+
+	if (run_write_ir) ir_bin.header();
+	if (run_write_ir_text) ir_text.header();
+	if (run_face_cache) make_cache_dir(run_face_cache);
+	if (run_mesh_cache) make_cache_dir(run_mesh_cache);
+	if (run_progress) set_progress_callback(print_progress);
+	run_clock.reset();
+	signal(SIGINT, on_sigint);
+}
+
+static double maxrss_mb(int who)
+{
+	struct rusage ru;
+	if (getrusage(who, &ru) != 0) return 0;
+#ifdef __APPLE__
+	return ru.ru_maxrss / (1024.0*1024.0); /* bytes */
+#else
+	return ru.ru_maxrss / 1024.0; /* kilobytes */
+#endif
+}
+
+static void write_ir_file(const ir_writer& w, const char* path_prefix, const char* ext)
+{
+	char* filename = str_concat(path_prefix, ext);
+	FILE* f = fopen_for_write(filename);
+	fwrite(w.out.data(), 1, w.out.size(), f);
+	fclose(f);
+	free(filename);
+}
+
+void exit_main()
+{
+	writer_pipeline.drain();
+
+	if (run_write_ir) write_ir_file(ir_bin, run_write_ir, ".cgir");
+	if (run_write_ir_text) write_ir_file(ir_text, run_write_ir_text, ".cgir.txt");
+	if (run_markers_out) write_markers_json(run_markers_out);
+	if (run_write_glb) write_glb(run_write_glb);
+
+	printf("peak memory: %.1f MB%s\n", maxrss_mb(RUSAGE_SELF), run_low_memory ? " (--low-memory)" : "");
+	if (run_isolate) printf("peak worker memory: %.1f MB\n", maxrss_mb(RUSAGE_CHILDREN));
+	printf("[ %.3fs ] total\n", run_clock.time());
 }
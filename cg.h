@@ -66,6 +66,14 @@ v3 operator "" _Z(long double z)        { return z_axis(z); }
 v3 operator "" _Z(unsigned long long z) { return z_axis(z); }
 
 
+/* called as objects are built with the fraction done (0..1) and a label of
+ * the node running; return false to cancel. A cancel (also SIGINT, or
+ * --deadline) takes effect at the next check: the run stops and reports
+ * the node it was in */
+typedef bool (*progress_callback)(double fraction, const char* running, void* usr);
+void set_progress_callback(progress_callback cb, void* usr = NULL);
+void cancel_evaluation();
+
 void _grp0();
 int _grp1();
 #define _GRP0 for(
@@ -81,11 +89,24 @@ void sphere(double radius=1);
 void cylinder(double radius=1, double height=1);
 void cone(double r0=1, double r1=0.5, double height=1);
 
+/* loads a shape written by --write-brep <name> (i.e. "<name>.brep"); a file
+ * is only read once however many times it is imported */
+void import_brep(const char* path);
+
 void cullbox(const v3& size);
 void cullbox(double sx=1, double sy=1, double sz=1);
 
 void marker(const char* name);
 
+/* replays the objects, markers and cull volumes saved by --write-ir or
+ * --write-ir-text as if this program had made them */
+void load_ir(const char* path);
+
+/* scene exports (--write-glb) store this object's mesh once and place an
+ * instance of it at every marker(marker_name) transform; call it inside
+ * the mkobj() body */
+void instance_at(const char* marker_name);
+
 #define translate(...) _GRP0 _grp_translate(__VA_ARGS__) _GRP1
 void _grp_translate(const v3& v);
 void _grp_translate(double x=0, double y=0, double z=0);
@@ -109,6 +130,49 @@ void _grp_common();
 #define fillet(x)      _GRP0 _grp_fillet(x)              _GRP1
 void _grp_fillet(double radius);
 
+/* the body hollowed out to walls of the given thickness, its outside
+ * kept; planar faces facing along one of the open directions (local, up
+ * to six) are left out, e.g. shell(2, z_axis()) on a box is a tray. One
+ * offset pass instead of cutting an inner copy out of the body */
+#define shell(...)     _GRP0 _grp_shell(__VA_ARGS__)     _GRP1
+void _grp_shell(double thickness, const v3& open0=v3(), const v3& open1=v3(), const v3& open2=v3(), const v3& open3=v3(), const v3& open4=v3(), const v3& open5=v3());
+
+/* the body grown (distance > 0) or shrunk (distance < 0) by distance all
+ * around; grown edges and corners are rounded */
+#define offset(d)      _GRP0 _grp_offset(d)              _GRP1
+void _grp_offset(double distance);
+
+/* meshes the faces produced by the body with these deflections instead
+ * of the mkobj() ones (is_relative still comes from mkobj()) */
+#define resolution(...) _GRP0 _grp_resolution(__VA_ARGS__) _GRP1
+void _grp_resolution(double linear_deflection, double angular_deflection=0.5);
+
+/* the body fused with its mirror image across the plane through the local
+ * origin with normal plane_normal. The body is built once and the copy
+ * glued on, so it should lie on one side of the plane (touching it is
+ * fine); markers and cullboxes inside are mirrored too */
+#define mirror(n)      _GRP0 _grp_mirror(n)              _GRP1
+void _grp_mirror(const v3& plane_normal);
+
+/* like mirror(), with n copies of the body rotated about axis (through the
+ * local origin) in steps of 360/n degrees; the body should fit in one
+ * 360/n wedge */
+#define symmetric(...) _GRP0 _grp_symmetric(__VA_ARGS__) _GRP1
+void _grp_symmetric(int n, const v3& axis=v3(0,0,1));
+
+/* count copies of the body, each step further than the last (the first
+ * is the body where it is). The body is built once and the copies are
+ * placed, not fused; inside cut/fuse/common they are all one tool, so
+ * use these instead of loops of translate()s for holes, ribs, etc.
+ * Markers and cullboxes inside are repeated too */
+#define pattern_linear(...) _GRP0 _grp_pattern_linear(__VA_ARGS__) _GRP1
+void _grp_pattern_linear(int count, const v3& step);
+
+/* like pattern_linear(), with each copy rotated a further degrees about
+ * axis (through the local origin) */
+#define pattern_polar(...) _GRP0 _grp_pattern_polar(__VA_ARGS__) _GRP1
+void _grp_pattern_polar(int count, const v3& axis, double degrees);
+
 #define face           _GRP0 _grp_face()                 _GRP1
 void _grp_face();
 
@@ -119,9 +183,21 @@ void line_to(double x=0, double y=0, double z=0);
 void circle_arc_to(const v3& point_on_circle, const v3& end_point);
 // TODO OpenCASCADE has all the conic sections: circle, ellipse, parabola, hyperbola
 
+/* a closed circular loop; inside face{}, each move_to() after the first
+ * edge and each circle() starts another loop, and loops after the first
+ * are holes in it */
+void circle(const v3& center, double radius, const v3& normal=v3(0,0,1));
+
 #define prism(v)       _GRP0 _grp_prism(v)                   _GRP1
 void _grp_prism(const v3& v);
 
+/* the face{} profiles in the body swept by degrees about axis (through
+ * the local origin); a profile should lie in a plane through the axis,
+ * on one side of it. A full turn of half an outline is a solid of
+ * revolution with no boolean work, e.g. capsule() in cgutil.h */
+#define revolve(...)   _GRP0 _grp_revolve(__VA_ARGS__)       _GRP1
+void _grp_revolve(const v3& axis, double degrees=360);
+
 static inline double deg2rad(double deg)
 {
 	return (deg*2.0*M_PI)/360.0;
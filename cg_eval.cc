@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "cg.h"
+
+/* evaluates a model saved with --write-ir or --write-ir-text without
+ * compiling it; takes the same options as a compiled model, e.g.
+ *   ./cg-eval model.cgir --write-obj model
+ */
+
+void init_main(int argc, char** argv);
+void exit_main();
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argv[1][0] == '-') {
+		fprintf(stderr, "usage: %s <model.cgir|model.cgir.txt> <opts...>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* the options follow the IR path */
+	const char* path = argv[1];
+	argv[1] = argv[0];
+	init_main(argc-1, argv+1);
+	load_ir(path);
+	exit_main();
+	return EXIT_SUCCESS;
+}
@@ -7,10 +7,12 @@
 void cgmain(); // <<< this is your entry point; define this function
 
 void init_main(int argc, char** argv);
+void exit_main();
 int main(int argc, char** argv)
 {
 	init_main(argc, argv);
 	cgmain();
+	exit_main();
 	return EXIT_SUCCESS;
 }
 
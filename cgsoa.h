@@ -0,0 +1,136 @@
+#ifndef CGSOA_H
+
+#include <stddef.h>
+#include <math.h>
+#include <vector>
+#include "cg.h"
+
+/* structure-of-arrays point/vector batches and kernels over them. Where
+ * v3 handles one point at a time, these loop over separate x/y/z arrays
+ * that never alias, which compilers turn into SIMD code at -O2 */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SOA_RESTRICT __restrict__
+#else
+#define SOA_RESTRICT
+#endif
+
+struct soa3 {
+	std::vector<double> x, y, z;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+	void set(size_t i, const v3& v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+	v3 get(size_t i) const { return v3(x[i], y[i], z[i]); }
+};
+
+static inline void soa_load(const v3* in, size_t n, soa3& out)
+{
+	out.resize(n);
+	for (size_t i = 0; i < n; i++) out.set(i, in[i]);
+}
+
+static inline void soa_load(const std::vector<v3>& in, soa3& out)
+{
+	soa_load(in.data(), in.size(), out);
+}
+
+/* out = m * in; m is a row-major 3x4 affine matrix. out must not be in */
+static inline void soa_transform(const double m[12], const soa3& in, soa3& out)
+{
+	const size_t n = in.size();
+	out.resize(n);
+	const double* SOA_RESTRICT ix = in.x.data();
+	const double* SOA_RESTRICT iy = in.y.data();
+	const double* SOA_RESTRICT iz = in.z.data();
+	double* SOA_RESTRICT ox = out.x.data();
+	double* SOA_RESTRICT oy = out.y.data();
+	double* SOA_RESTRICT oz = out.z.data();
+	for (size_t i = 0; i < n; i++) {
+		const double px = ix[i], py = iy[i], pz = iz[i];
+		ox[i] = m[0]*px + m[1]*py + m[2]*pz + m[3];
+		oy[i] = m[4]*px + m[5]*py + m[6]*pz + m[7];
+		oz[i] = m[8]*px + m[9]*py + m[10]*pz + m[11];
+	}
+}
+
+/* unit normals of the triangles (a[i], b[i], c[i]), counter-clockwise;
+ * degenerate triangles get a zero normal */
+static inline void soa_face_normals(const soa3& a, const soa3& b, const soa3& c, soa3& out)
+{
+	const size_t n = a.size();
+	out.resize(n);
+	const double* SOA_RESTRICT ax = a.x.data();
+	const double* SOA_RESTRICT ay = a.y.data();
+	const double* SOA_RESTRICT az = a.z.data();
+	const double* SOA_RESTRICT bx = b.x.data();
+	const double* SOA_RESTRICT by = b.y.data();
+	const double* SOA_RESTRICT bz = b.z.data();
+	const double* SOA_RESTRICT cx = c.x.data();
+	const double* SOA_RESTRICT cy = c.y.data();
+	const double* SOA_RESTRICT cz = c.z.data();
+	double* SOA_RESTRICT ox = out.x.data();
+	double* SOA_RESTRICT oy = out.y.data();
+	double* SOA_RESTRICT oz = out.z.data();
+	for (size_t i = 0; i < n; i++) {
+		const double ux = bx[i]-ax[i], uy = by[i]-ay[i], uz = bz[i]-az[i];
+		const double vx = cx[i]-ax[i], vy = cy[i]-ay[i], vz = cz[i]-az[i];
+		const double nx = uy*vz - uz*vy;
+		const double ny = uz*vx - ux*vz;
+		const double nz = ux*vy - uy*vx;
+		const double len = sqrt(nx*nx + ny*ny + nz*nz);
+		const double s = len > 0 ? 1/len : 0;
+		ox[i] = nx*s;
+		oy[i] = ny*s;
+		oz[i] = nz*s;
+	}
+}
+
+/* signed distances of the points to the plane through p with unit
+ * normal n; positive in front */
+static inline void soa_plane_distances(const soa3& pts, const v3& p, const v3& n, double* SOA_RESTRICT out)
+{
+	const size_t count = pts.size();
+	const double* SOA_RESTRICT px = pts.x.data();
+	const double* SOA_RESTRICT py = pts.y.data();
+	const double* SOA_RESTRICT pz = pts.z.data();
+	for (size_t i = 0; i < count; i++) {
+		out[i] = (px[i]-p.x)*n.x + (py[i]-p.y)*n.y + (pz[i]-p.z)*n.z;
+	}
+}
+
+/* our Z-up to the Y-up of OBJ/glTF: (x, z, -y). out must not be in */
+static inline void soa_swizzle_yup(const soa3& in, soa3& out)
+{
+	const size_t n = in.size();
+	out.resize(n);
+	const double* SOA_RESTRICT iy = in.y.data();
+	const double* SOA_RESTRICT iz = in.z.data();
+	double* SOA_RESTRICT oy = out.y.data();
+	double* SOA_RESTRICT oz = out.z.data();
+	out.x = in.x;
+	for (size_t i = 0; i < n; i++) {
+		oy[i] = iz[i];
+		oz[i] = -iy[i];
+	}
+}
+
+/* axis-aligned bounds; mn > mx when there are no points */
+static inline void soa_bounds(const soa3& pts, v3& mn, v3& mx)
+{
+	const std::vector<double>* axes[3] = { &pts.x, &pts.y, &pts.z };
+	for (int k = 0; k < 3; k++) {
+		const double* SOA_RESTRICT c = axes[k]->data();
+		const size_t n = axes[k]->size();
+		double lo = INFINITY, hi = -INFINITY;
+		for (size_t i = 0; i < n; i++) {
+			lo = c[i] < lo ? c[i] : lo;
+			hi = c[i] > hi ? c[i] : hi;
+		}
+		mn.s[k] = lo;
+		mx.s[k] = hi;
+	}
+}
+
+#define CGSOA_H
+#endif
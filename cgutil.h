@@ -1,10 +1,13 @@
 #ifndef CGUTIL_H
 
 void capsule(double r, double h) {
-	fuse {
-		translate(0,0,r) sphere(r);
-		translate(0,0,r) cylinder(r, h-r*2);
-		translate(0,0,h-r) sphere(r);
+	revolve(z_axis()) face {
+		double cc = sin(M_PI/4)*r;
+		move_to(0, 0, 0);
+		circle_arc_to(v3(cc, 0, r-cc), v3(r, 0, r));
+		if (h > r*2) line_to(r, 0, h-r);
+		circle_arc_to(v3(cc, 0, h-r+cc), v3(0, 0, h));
+		line_to(0, 0, 0);
 	}
 }
 
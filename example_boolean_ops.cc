@@ -18,21 +18,17 @@ void cgmain()
 		              fuse   objs();
 		translate(4)  common objs();
 
-		/* do some stress testing; perforate a box with a bunch of cylinders */
+		/* do some stress testing; perforate a box with a bunch of cylinders.
+		 * Each pattern is one cylinder built once, and all three cut in a
+		 * single boolean (split into tiles with e.g. --tile-booleans 32) */
 		translate(0,10) translate(-5,-5) {
 			cut {
 				translate(-0.5_Z) box(10,10,1);
-				for (int x = 0; x <= 10; x++) {
-					for (int y = 0; y <= 10; y++) {
-						translate(x, y, -1) cylinder(0.3, 4);
-					}
-				}
-				for (int x = 0; x <= 10; x++) {
-					translate(x) rotate(-90_X) translate(-1_Z) cylinder(0.3, 12);
-				}
-				for (int y = 0; y <= 10; y++) {
-					translate(0,y) rotate(90_Y) translate(-1_Z) cylinder(0.3, 12);
+				pattern_linear(11, 1_X) pattern_linear(11, 1_Y) {
+					translate(0, 0, -1) cylinder(0.3, 4);
 				}
+				pattern_linear(11, 1_X) rotate(-90_X) translate(-1_Z) cylinder(0.3, 12);
+				pattern_linear(11, 1_Y) rotate(90_Y) translate(-1_Z) cylinder(0.3, 12);
 			}
 		}
 	}
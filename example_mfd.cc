@@ -43,16 +43,23 @@ void cgmain()
 				translate(-sx/2, -sy/2, -1) box(sx, sy, depth+2);
 			};
 
+			const double d = side/2 + (0.5 - (double)n_buttons_per_side/2) * button_spacing;
+			auto std_button_row = [&](const v3& step) {
+				pattern_linear(n_buttons_per_side, step) button_hole(button_size, button_size);
+			};
+			translate(d,margin/2) std_button_row(x_axis(button_spacing));
+			translate(d,side-margin/2) std_button_row(x_axis(button_spacing));
+			translate(margin/2,d) std_button_row(y_axis(button_spacing));
+			translate(side-margin/2,d) std_button_row(y_axis(button_spacing));
+
+			/* markers go button by button, all four sides at a time;
+			 * users index them by position */
 			for (int i = 0; i < n_buttons_per_side; i++) {
-				double d = side/2 + (i - (double)n_buttons_per_side/2 + 0.5) * button_spacing;
-				auto std_button_hole = [&]() {
-					button_hole(button_size, button_size);
-					marker("std_buttons");
-				};
-				translate(d,margin/2) std_button_hole();
-				translate(d,side-margin/2) std_button_hole();
-				translate(margin/2,d) std_button_hole();
-				translate(side-margin/2,d) std_button_hole();
+				double di = d + i * button_spacing;
+				translate(di,margin/2) marker("std_buttons");
+				translate(di,side-margin/2) marker("std_buttons");
+				translate(margin/2,di) marker("std_buttons");
+				translate(side-margin/2,di) marker("std_buttons");
 			}
 
 			auto xx_button = [&](double x0, double x1) {
@@ -81,14 +88,13 @@ void cgmain()
 					capsule(button_spacer_r, margin - button_spacer_margin*2);
 				}
 			};
+			const double d = side/2 - ((double)n_buttons_per_side/2) * button_spacing;
+			const int n = n_buttons_per_side+1;
 			translate(0,0,depth) {
-				for (int i = 0; i <= n_buttons_per_side; i++) {
-					double d = side/2 + (i - (double)n_buttons_per_side/2) * button_spacing;
-					translate(d) spacer();
-					translate(d, side-margin) spacer();
-					translate(0,d) rotate(-90_Z) spacer();
-					translate(side-margin,d) rotate(-90_Z) spacer();
-				}
+				translate(d) pattern_linear(n, x_axis(button_spacing)) spacer();
+				translate(d, side-margin) pattern_linear(n, x_axis(button_spacing)) spacer();
+				translate(0,d) pattern_linear(n, y_axis(button_spacing)) rotate(-90_Z) spacer();
+				translate(side-margin,d) pattern_linear(n, y_axis(button_spacing)) rotate(-90_Z) spacer();
 			}
 		};
 